@@ -0,0 +1,234 @@
+/* -*- indent-tabs-mode: nil -*- */
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+#include "JobScheduler.h"
+
+namespace {
+    extern "C" void* job_scheduler_run(void* arg) {
+        JobScheduler* js = (JobScheduler*)arg;
+        js->run();
+        pthread_exit(0);
+        return 0;
+    }
+}
+
+int JobScheduler::start(ExceptionSink* xsink) {
+    AutoLocker al(m);
+    assert(!running);
+
+    pthread_t ptid;
+    int rc = pthread_create(&ptid, 0, job_scheduler_run, this);
+    if (rc) {
+        xsink->raiseErrnoException("JOBSCHEDULER-THREAD-ERROR", rc, "could not create job scheduler timer thread: "
+            "pthread_create() failed");
+        return -1;
+    }
+    pthread_detach(ptid);
+    running = true;
+    return 0;
+}
+
+void JobScheduler::shutdown() {
+    AutoLocker al(m);
+    stop = true;
+    cond.signal();
+    while (running) {
+        cstop.wait(m);
+    }
+}
+
+void JobScheduler::run() {
+    AutoLocker al(m);
+    while (!stop) {
+        int64 now = js_now_us();
+        int64 next = process(now);
+
+        int64 wait_ms = next ? (next - now + 999) / 1000 : QORUS_JS_MAX_WAIT;
+        if (wait_ms > QORUS_JS_MAX_WAIT) {
+            wait_ms = QORUS_JS_MAX_WAIT;
+        }
+        cond.wait(m, (int)wait_ms);
+    }
+    running = false;
+    cstop.broadcast();
+}
+
+int64 JobScheduler::process(int64 now) {
+    // move due jobs to the ready queue
+    while (!timers.empty()) {
+        const Timer& t = timers.top();
+        if (!isCurrent(t)) {
+            timers.pop();
+            continue;
+        }
+        if (t.due > now) {
+            break;
+        }
+        JobEntry& job = jobs[t.jobid];
+        // a job that is waiting for a worker or running keeps its trigger time and is dispatched again when its
+        // run is done
+        if (!job.ready && !job.running) {
+            job.dispatched_due = job.due;
+            job.due = 0;
+            job.ready = true;
+            ready.push_back(t.jobid);
+        }
+        timers.pop();
+    }
+
+    // dispatch ready jobs while there are free workers
+    while (!ready.empty() && nrunning < max_running) {
+        int64 jobid = ready.front();
+        ready.pop_front();
+        jobmap_t::iterator i = jobs.find(jobid);
+        // skip jobs removed while waiting
+        if (i == jobs.end() || !i->second.ready) {
+            continue;
+        }
+        dispatch(jobid, i->second, now);
+    }
+
+    // return the earliest future trigger time
+    while (!timers.empty() && !isCurrent(timers.top())) {
+        timers.pop();
+    }
+    return timers.empty() ? 0 : timers.top().due;
+}
+
+void JobScheduler::dispatch(int64 jobid, JobEntry& job, int64 now) {
+    job.ready = false;
+    job.running = true;
+    ++nrunning;
+    ++dispatched;
+
+    int64 late = now - job.dispatched_due;
+    lateness.add(late);
+
+    QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+    h->setKeyValue("jobid", jobid, nullptr);
+    h->setKeyValue("trigger", DateTimeNode::makeAbsolute(currentTZ(), job.dispatched_due / 1000000,
+        (int)(job.dispatched_due % 1000000)), nullptr);
+    h->setKeyValue("lateness", late, nullptr);
+    q->pushAndTakeRef(h);
+}
+
+void JobScheduler::schedule(int64 jobid, int64 due) {
+    AutoLocker al(m);
+    JobEntry& job = jobs[jobid];
+    job.removed = false;
+    // a job waiting for a worker keeps its place and the trigger time it was queued with; the new trigger time is
+    // dispatched after the run
+    job.due = due;
+    // the timer thread only needs to wake up if the job is now the earliest trigger
+    bool wake = timers.empty() || due < timers.top().due;
+    timers.push(Timer{due, jobid});
+    if (timers.size() > QORUS_JS_COMPACT_FACTOR * jobs.size() + 64) {
+        compact();
+    }
+    if (wake) {
+        cond.signal();
+    }
+}
+
+bool JobScheduler::remove(int64 jobid) {
+    AutoLocker al(m);
+    jobmap_t::iterator i = jobs.find(jobid);
+    if (i == jobs.end()) {
+        return false;
+    }
+    if (i->second.running) {
+        i->second.due = 0;
+        i->second.removed = true;
+        return true;
+    }
+    // stale heap and ready queue entries are skipped
+    jobs.erase(i);
+    return false;
+}
+
+bool JobScheduler::done(int64 jobid) {
+    AutoLocker al(m);
+    jobmap_t::iterator i = jobs.find(jobid);
+    if (i == jobs.end() || !i->second.running) {
+        return false;
+    }
+    assert(nrunning);
+    --nrunning;
+    // wake up the timer thread if a job is waiting for a free worker
+    if (!ready.empty()) {
+        cond.signal();
+    }
+
+    if (i->second.removed) {
+        jobs.erase(i);
+        return true;
+    }
+
+    JobEntry& job = i->second;
+    job.running = false;
+    // a job that became due while it was waiting for a worker or running is dispatched now; its heap entry has
+    // been removed
+    if (job.due && job.due <= js_now_us()) {
+        timers.push(Timer{job.due, jobid});
+        cond.signal();
+    }
+    return false;
+}
+
+QoreHashNode* JobScheduler::getInfo() {
+    ReferenceHolder<QoreHashNode> h(new QoreHashNode(autoTypeInfo), nullptr);
+    AutoLocker al(m);
+
+    int64 scheduled = 0;
+    for (auto& i : jobs) {
+        if (i.second.due) {
+            ++scheduled;
+        }
+    }
+
+    h->setKeyValue("jobs", (int64)jobs.size(), nullptr);
+    h->setKeyValue("scheduled", scheduled, nullptr);
+    h->setKeyValue("ready", (int64)ready.size(), nullptr);
+    h->setKeyValue("running", (int64)nrunning, nullptr);
+    h->setKeyValue("max_running", (int64)max_running, nullptr);
+    h->setKeyValue("dispatched", dispatched, nullptr);
+    while (!timers.empty() && !isCurrent(timers.top())) {
+        timers.pop();
+    }
+    if (!timers.empty()) {
+        int64 next = timers.top().due;
+        h->setKeyValue("next", DateTimeNode::makeAbsolute(currentTZ(), next / 1000000, (int)(next % 1000000)),
+            nullptr);
+    }
+
+    ReferenceHolder<QoreHashNode> l(new QoreHashNode(autoTypeInfo), nullptr);
+    l->setKeyValue("count", (int64)lateness.getCount(), nullptr);
+    l->setKeyValue("avg", lateness.getAverage(), nullptr);
+    l->setKeyValue("p50", lateness.getPercentile(0.5), nullptr);
+    l->setKeyValue("p90", lateness.getPercentile(0.9), nullptr);
+    l->setKeyValue("p99", lateness.getPercentile(0.99), nullptr);
+    l->setKeyValue("max", lateness.getMax(), nullptr);
+    h->setKeyValue("lateness", l.release(), nullptr);
+
+    return h.release();
+}
+
+void JobScheduler::compact() {
+    std::vector<Timer> v;
+    v.reserve(jobs.size());
+    while (!timers.empty()) {
+        if (isCurrent(timers.top())) {
+            v.push_back(timers.top());
+        }
+        timers.pop();
+    }
+    timers = std::priority_queue<Timer>(v.begin(), v.end());
+}
@@ -0,0 +1,180 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    JobScheduler.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Central job scheduler with the following properties:
+    * a single timer thread owns the trigger times of all jobs in a process; trigger times are kept in a binary heap
+      ordered by time, so the thread only ever waits for the earliest trigger
+    * rescheduling or removing a job does not search the heap; the job's entry is updated and heap entries that no
+      longer match their job's trigger time are discarded when they reach the top of the heap
+    * due jobs are dispatched as messages to a Queue served by a bounded pool of worker threads; no more than the
+      pool size are dispatched at once, and due jobs wait in FIFO order for a free slot
+    * a job is never dispatched again before the worker reports its run as done; a job that becomes due while it is
+      waiting for a worker or its run is in progress is dispatched with its new trigger time when the run is done, so
+      a trigger time that has passed is never merged into another run
+    * trigger lateness (dispatch time - trigger time) is recorded for every dispatch, so lateness includes delays
+      caused by a saturated worker pool
+*/
+
+#ifndef _QORUS_JOB_SCHEDULER_H
+#define _QORUS_JOB_SCHEDULER_H
+
+#include <qore/Qore.h>
+
+#include "LatencyHistogram.h"
+
+#include <time.h>
+
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// the maximum time the timer thread waits in ms, so changes to the system clock are picked up
+#define QORUS_JS_MAX_WAIT 1000
+
+// heaps with more than this many stale entries per scheduled job are rebuilt
+#define QORUS_JS_COMPACT_FACTOR 2
+
+// returns the current time in microseconds since the epoch
+DLLLOCAL inline int64 js_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+class JobScheduler : public AbstractPrivateData {
+public:
+    // creates the scheduler; the Queue must be already referenced for assignment
+    DLLLOCAL JobScheduler(Queue* q, unsigned max_running) : q(q), max_running(max_running) {
+    }
+
+    // starts the timer thread
+    DLLLOCAL int start(ExceptionSink* xsink);
+
+    // stops the timer thread; no further runs are dispatched
+    DLLLOCAL void shutdown();
+
+    // sets the next trigger time for the given job in microseconds since the epoch
+    /** replaces any existing trigger time; if the job is waiting for a worker or its run is in progress, the job is
+        dispatched with the new trigger time when the run is done
+    */
+    DLLLOCAL void schedule(int64 jobid, int64 due);
+
+    // removes the given job from the scheduler
+    /** @return true if a run of the job has been dispatched and done() has not been called for it yet; in this case
+        the job is removed when done() is called
+    */
+    DLLLOCAL bool remove(int64 jobid);
+
+    // reports that the dispatched run of the given job is done
+    /** @return true if the job was removed while the run was in progress
+    */
+    DLLLOCAL bool done(int64 jobid);
+
+    // returns scheduler status and trigger lateness statistics
+    DLLLOCAL QoreHashNode* getInfo();
+
+    // runs the timer thread
+    DLLLOCAL void run();
+
+protected:
+    DLLLOCAL virtual ~JobScheduler() {
+        assert(!running);
+    }
+
+    DLLLOCAL virtual void deref(ExceptionSink* xsink) {
+        if (QoreReferenceCounter::ROdereference()) {
+            q->deref(xsink);
+            delete this;
+        }
+    }
+
+private:
+    struct JobEntry {
+        // the next trigger time or 0 if the job is not scheduled
+        int64 due = 0;
+        // the trigger time of the job while it is waiting for a worker or running
+        int64 dispatched_due = 0;
+        // the job is in the ready queue
+        bool ready = false;
+        // a run of the job has been dispatched and not yet reported as done
+        bool running = false;
+        // the job was removed while its run was in progress
+        bool removed = false;
+    };
+
+    // heap entry; stale if the job's trigger time no longer matches
+    struct Timer {
+        int64 due;
+        int64 jobid;
+
+        // orders the heap with the earliest trigger time on top
+        DLLLOCAL bool operator<(const Timer& t) const {
+            return due > t.due || (due == t.due && jobid > t.jobid);
+        }
+    };
+
+    typedef std::unordered_map<int64, JobEntry> jobmap_t;
+    jobmap_t jobs;
+
+    // trigger times
+    std::priority_queue<Timer> timers;
+
+    // jobs that are due and waiting for a free worker
+    std::deque<int64> ready;
+
+    // dispatch queue for the worker pool
+    Queue* q;
+
+    // trigger lateness in microseconds
+    LatencyHistogram lateness;
+
+    // total number of runs dispatched
+    int64 dispatched = 0;
+
+    // maximum number of runs dispatched at once
+    unsigned max_running;
+    // number of runs dispatched and not yet done
+    unsigned nrunning = 0;
+
+    QoreThreadLock m;
+    // timer condition var; signaled when the earliest trigger time may have changed or a worker is free
+    QoreCondition cond;
+    // shutdown condition var
+    QoreCondition cstop;
+
+    bool running = false;
+    bool stop = false;
+
+    // moves due jobs to the ready queue and dispatches ready jobs up to the pool size; the lock must be held
+    /** @return the earliest future trigger time or 0 if there is none
+    */
+    DLLLOCAL int64 process(int64 now);
+
+    // dispatches the given job; the lock must be held
+    DLLLOCAL void dispatch(int64 jobid, JobEntry& job, int64 now);
+
+    // rebuilds the heap without stale entries; the lock must be held
+    DLLLOCAL void compact();
+
+    // returns true if the heap entry matches its job's trigger time
+    DLLLOCAL bool isCurrent(const Timer& t) const {
+        jobmap_t::const_iterator i = jobs.find(t.jobid);
+        return i != jobs.end() && i->second.due == t.due;
+    }
+};
+
+#endif
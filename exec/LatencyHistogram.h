@@ -0,0 +1,370 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    LatencyHistogram.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Latency histogram and lock-free sample accumulator for performance caches:
+    * values below LH_LINEAR_MAX each have their own bucket
+    * above that, each power of two is split into LH_SUB_BUCKETS linear sub-buckets, so the relative error of
+      any reported percentile is bounded by 1 / LH_SUB_BUCKETS over the entire positive int64 range
+    * histograms are mergeable by adding bucket counts; this allows lossless rollups into longer intervals
+    * the accumulator is written to by any number of threads without locking and is drained by a single thread
+      (the performance cache manager) once per tick; posting threads are spread over stripes, each with its own
+      bucket counts and totals that are swapped out together when drained
+*/
+
+#ifndef _QORUS_LATENCY_HISTOGRAM_H
+#define _QORUS_LATENCY_HISTOGRAM_H
+
+#include <qore/Qore.h>
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+
+// number of bits used for the sub-buckets of each power of two
+#define LH_SUB_BITS 3
+// number of linear sub-buckets for each power of two
+#define LH_SUB_BUCKETS (1 << LH_SUB_BITS)
+// values below this limit are stored exactly
+#define LH_LINEAR_MAX (LH_SUB_BUCKETS << 1)
+// total number of buckets to cover all positive int64 values
+#define LH_BUCKETS (LH_LINEAR_MAX + (63 - LH_SUB_BITS) * LH_SUB_BUCKETS)
+
+// number of accumulator stripes; threads are assigned to stripes round-robin
+#define PA_STRIPES 4
+// cache line size for accumulator stripes
+#define PA_CACHE_LINE 64
+
+class LatencyHistogram {
+public:
+    DLLLOCAL LatencyHistogram() {
+    }
+
+    DLLLOCAL LatencyHistogram(const LatencyHistogram& old) : count(old.count), sum(old.sum), max(old.max) {
+        if (old.buckets) {
+            allocate();
+            memcpy(buckets.get(), old.buckets.get(), sizeof(uint64_t) * LH_BUCKETS);
+        }
+    }
+
+    DLLLOCAL LatencyHistogram& operator=(const LatencyHistogram& old) {
+        if (this != &old) {
+            clear();
+            merge(old);
+        }
+        return *this;
+    }
+
+    // returns the bucket index for the given value; negative values are treated as 0
+    DLLLOCAL static unsigned getIndex(int64 v) {
+        if (v < LH_LINEAR_MAX) {
+            return v > 0 ? (unsigned)v : 0;
+        }
+        unsigned e = 63 - __builtin_clzll((uint64_t)v);
+        unsigned sub = ((uint64_t)v >> (e - LH_SUB_BITS)) & (LH_SUB_BUCKETS - 1);
+        return LH_LINEAR_MAX + (e - LH_SUB_BITS - 1) * LH_SUB_BUCKETS + sub;
+    }
+
+    // returns the lowest value stored in the given bucket
+    DLLLOCAL static uint64_t getLowerBound(unsigned idx) {
+        if (idx < LH_LINEAR_MAX) {
+            return idx;
+        }
+        idx -= LH_LINEAR_MAX;
+        unsigned shift = idx / LH_SUB_BUCKETS + 1;
+        return (uint64_t)(LH_SUB_BUCKETS + (idx % LH_SUB_BUCKETS)) << shift;
+    }
+
+    // returns the width of the given bucket
+    DLLLOCAL static uint64_t getWidth(unsigned idx) {
+        return idx < LH_LINEAR_MAX ? 1 : (1ull << ((idx - LH_LINEAR_MAX) / LH_SUB_BUCKETS + 1));
+    }
+
+    DLLLOCAL void add(int64 v) {
+        addBucket(getIndex(v), 1);
+        addTotals(v, v);
+    }
+
+    // adds samples directly to a bucket; the sum and maximum must be added with addTotals()
+    DLLLOCAL void addBucket(unsigned idx, uint64_t n) {
+        assert(idx < LH_BUCKETS);
+        allocate();
+        buckets[idx] += n;
+        count += n;
+    }
+
+    DLLLOCAL void addTotals(double n_sum, int64 n_max) {
+        sum += n_sum;
+        if (n_max > max) {
+            max = n_max;
+        }
+    }
+
+    // adds all samples from the given histogram to this one
+    DLLLOCAL void merge(const LatencyHistogram& h) {
+        if (!h.count) {
+            return;
+        }
+        allocate();
+        for (unsigned i = 0; i < LH_BUCKETS; ++i) {
+            buckets[i] += h.buckets[i];
+        }
+        count += h.count;
+        addTotals(h.sum, h.max);
+    }
+
+    // resets the histogram; the bucket array is retained for reuse
+    DLLLOCAL void clear() {
+        if (count) {
+            memset(buckets.get(), 0, sizeof(uint64_t) * LH_BUCKETS);
+            count = 0;
+        }
+        sum = 0.0;
+        max = 0;
+    }
+
+    DLLLOCAL bool empty() const {
+        return !count;
+    }
+
+    DLLLOCAL uint64_t getCount() const {
+        return count;
+    }
+
+    DLLLOCAL double getSum() const {
+        return sum;
+    }
+
+    DLLLOCAL int64 getMax() const {
+        return max;
+    }
+
+    DLLLOCAL double getAverage() const {
+        return count ? sum / (double)count : 0.0;
+    }
+
+    // returns the value at the given quantile (0.0 - 1.0); the midpoint of the matching bucket is returned,
+    // capped by the maximum recorded value
+    DLLLOCAL int64 getPercentile(double q) const {
+        if (!count) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q * (double)count + 0.5);
+        if (!rank) {
+            rank = 1;
+        } else if (rank > count) {
+            rank = count;
+        }
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < LH_BUCKETS; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                int64 rv = (int64)(getLowerBound(i) + (getWidth(i) >> 1));
+                return rv > max ? max : rv;
+            }
+        }
+        return max;
+    }
+
+private:
+    // bucket counts; allocated on the first sample so that idle caches do not need the memory
+    std::unique_ptr<uint64_t[]> buckets;
+    // total number of samples
+    uint64_t count = 0;
+    // sum total of all sample values
+    double sum = 0.0;
+    // maximum sample value
+    int64 max = 0;
+
+    DLLLOCAL void allocate() {
+        if (!buckets) {
+            buckets.reset(new uint64_t[LH_BUCKETS]());
+        }
+    }
+};
+
+// lock-free multi-producer, single-consumer accumulator for performance samples
+/** each stripe has its own block with bucket counts and totals; the consumer replaces the block of each stripe with
+    an empty one in a single atomic exchange and waits for posts in progress on the old block to complete, so the
+    buckets, sum, and maximum drained always cover exactly the same samples
+*/
+class PerformanceAccumulator {
+public:
+    DLLLOCAL PerformanceAccumulator() {
+        // the stripes are allocated separately, because the owning object is not guaranteed to be allocated
+        // with cache line alignment
+        stripes = static_cast<Stripe*>(allocate(sizeof(Stripe) * PA_STRIPES));
+        for (unsigned i = 0; i < PA_STRIPES; ++i) {
+            new (&stripes[i]) Stripe;
+        }
+    }
+
+    DLLLOCAL PerformanceAccumulator(const PerformanceAccumulator&) = delete;
+    DLLLOCAL PerformanceAccumulator& operator=(const PerformanceAccumulator&) = delete;
+
+    DLLLOCAL ~PerformanceAccumulator() {
+        for (unsigned i = 0; i < PA_STRIPES; ++i) {
+            free(stripes[i].current.load(std::memory_order_relaxed));
+            free(stripes[i].spare);
+        }
+        free(stripes);
+    }
+
+    // posts a sample; may be called from any thread
+    DLLLOCAL void post(int64 v) {
+        if (v < 0) {
+            v = 0;
+        }
+        Block* b = stripes[getStripe()].acquire();
+        b->buckets[LatencyHistogram::getIndex(v)].fetch_add(1, std::memory_order_relaxed);
+        b->sum.fetch_add(v, std::memory_order_relaxed);
+        int64 m = b->max.load(std::memory_order_relaxed);
+        while (v > m && !b->max.compare_exchange_weak(m, v, std::memory_order_relaxed)) {
+        }
+        b->count.fetch_add(1, std::memory_order_relaxed);
+        // release the sample to the consumer
+        b->writers.fetch_sub(1, std::memory_order_release);
+    }
+
+    // returns true if samples were posted since the last drain
+    DLLLOCAL bool hasData() const {
+        for (unsigned i = 0; i < PA_STRIPES; ++i) {
+            Block* b = stripes[i].current.load(std::memory_order_acquire);
+            if (b && b->count.load(std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // moves all samples posted since the last call into the given histogram; must only be called from one
+    // thread at a time
+    /** a sample being posted concurrently is included in either this drain or the next one with its bucket, sum,
+        and maximum
+    */
+    DLLLOCAL void drain(LatencyHistogram& h) {
+        for (unsigned i = 0; i < PA_STRIPES; ++i) {
+            Stripe& s = stripes[i];
+            Block* b = s.current.load(std::memory_order_acquire);
+            if (!b || !b->count.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            if (!s.spare) {
+                s.spare = newBlock();
+            }
+            b = s.current.exchange(s.spare);
+            s.spare = nullptr;
+            // wait for posts that acquired the old block before the exchange
+            while (b->writers.load()) {
+                sched_yield();
+            }
+
+            for (unsigned j = 0; j < LH_BUCKETS; ++j) {
+                if (uint32_t n = b->buckets[j].load(std::memory_order_relaxed)) {
+                    h.addBucket(j, n);
+                    b->buckets[j].store(0, std::memory_order_relaxed);
+                }
+            }
+            h.addTotals((double)b->sum.load(std::memory_order_relaxed), b->max.load(std::memory_order_relaxed));
+            b->count.store(0, std::memory_order_relaxed);
+            b->sum.store(0, std::memory_order_relaxed);
+            b->max.store(0, std::memory_order_relaxed);
+            // the block is published again with the exchange in the next drain
+            s.spare = b;
+        }
+    }
+
+private:
+    // bucket counts and totals of the samples posted to a stripe since the last drain
+    struct Block {
+        // number of posts in progress on this block
+        std::atomic<unsigned> writers;
+        // number of samples posted
+        std::atomic<int64> count;
+        std::atomic<int64> sum;
+        std::atomic<int64> max;
+        std::atomic<uint32_t> buckets[LH_BUCKETS];
+    };
+
+    // one stripe per cache line to avoid false sharing between posting threads
+    struct alignas(PA_CACHE_LINE) Stripe {
+        // the block samples are posted to; allocated on the first sample so that idle caches do not need the memory
+        std::atomic<Block*> current;
+        // an empty block for the next drain; only accessed by the consumer
+        Block* spare = nullptr;
+
+        DLLLOCAL Stripe() : current(nullptr) {
+        }
+
+        // returns the current block with a post registered in progress; the post must be completed by decrementing
+        // the block's writer count
+        DLLLOCAL Block* acquire() {
+            while (true) {
+                Block* b = current.load(std::memory_order_acquire);
+                if (!b) {
+                    Block* nb = newBlock();
+                    if (!current.compare_exchange_strong(b, nb)) {
+                        free(nb);
+                    }
+                    continue;
+                }
+                b->writers.fetch_add(1);
+                // if the block is still current, the consumer waits for this post before draining it
+                if (current.load() == b) {
+                    return b;
+                }
+                b->writers.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    };
+    static_assert(sizeof(Stripe) == PA_CACHE_LINE, "accumulator stripes must fill exactly one cache line");
+
+    // cache line-aligned stripes
+    Stripe* stripes;
+
+    // returns a new empty block aligned to a cache line
+    DLLLOCAL static Block* newBlock() {
+        Block* b = new (allocate(sizeof(Block))) Block;
+        b->writers.store(0, std::memory_order_relaxed);
+        b->count.store(0, std::memory_order_relaxed);
+        b->sum.store(0, std::memory_order_relaxed);
+        b->max.store(0, std::memory_order_relaxed);
+        for (unsigned i = 0; i < LH_BUCKETS; ++i) {
+            b->buckets[i].store(0, std::memory_order_relaxed);
+        }
+        return b;
+    }
+
+    DLLLOCAL static void* allocate(size_t size) {
+        void* p;
+        if (posix_memalign(&p, PA_CACHE_LINE, size)) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    DLLLOCAL static unsigned getStripe() {
+        static std::atomic<unsigned> next = {0};
+        static thread_local unsigned stripe = next.fetch_add(1, std::memory_order_relaxed) % PA_STRIPES;
+        return stripe;
+    }
+};
+
+#endif
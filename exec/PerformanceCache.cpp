@@ -11,25 +11,167 @@
 
 #include "PerformanceCache.h"
 
-// defines the cycle time for cache updates: default 1 second (1000 ms)
-#define QORUS_PC_HZ 1000
+#include <unistd.h>
+
+void pc_add_event(pcoutbox_t& out, Queue* q, QoreHashNode* h) {
+   pcoutbox_t::iterator i = out.lower_bound(q);
+   if (i == out.end() || i->first != q) {
+      // the queue is referenced until the events are sent
+      q->ref();
+      i = out.insert(i, pcoutbox_t::value_type(q, new QoreListNode(autoTypeInfo)));
+   }
+   i->second->push(h, nullptr);
+}
+
+void PerformanceCacheShard::push(PerformanceCache* pc) {
+   PerformanceCache* h = dirty.load(std::memory_order_relaxed);
+   do {
+      pc->setNextDirty(h);
+   } while (!dirty.compare_exchange_weak(h, pc, std::memory_order_release, std::memory_order_relaxed));
+}
+
+PerformanceCacheManager::PerformanceCacheManager(unsigned nshards, unsigned tick_ms)
+      : tick_ns((int64)(tick_ms < QORUS_PC_MIN_TICK ? QORUS_PC_MIN_TICK : tick_ms) * 1000000LL), running(false),
+        stop(false) {
+   if (!nshards) {
+      long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+      nshards = ncpus > 1 ? (unsigned)(ncpus / 2) : 1;
+      if (nshards > QORUS_PC_MAX_SHARDS)
+         nshards = QORUS_PC_MAX_SHARDS;
+   }
+   for (unsigned i = 0; i < nshards; ++i)
+      shards.push_back(std::unique_ptr<PerformanceCacheShard>(new PerformanceCacheShard(this)));
+}
 
 void PerformanceCacheManager::run() {
-   while (!stop) {
-      AutoLocker al(m);
-      cevent.wait(m, QORUS_PC_HZ);
-      if (stop)
-	 break;
-
-      int64 now = q_epoch();
-      //printd(5, "PerformanceCacheManager::run() now: "QLLD" empty: %d\n", now, (int)pcmap.size());
-      for (pcmap_t::iterator i = pcmap.begin(), e = pcmap.end(); i != e; ++i)
-	 i->second->pop(now);
+   // ticks are scheduled on the monotonic clock
+   int64 next = pc_monotonic_ns() + tick_ns;
+   while (true) {
+      pcoutbox_t out;
+      {
+         AutoLocker al(m);
+         while (!stop) {
+            int64 wait_ns = next - pc_monotonic_ns();
+            if (wait_ns <= 0)
+               break;
+            cevent.wait(m, (int)((wait_ns + 999999) / 1000000));
+         }
+         if (stop)
+            break;
+
+         // start the tick on all shards and wait for them to finish
+         tick_now = pc_now_ns();
+         pending = shards.size();
+         ++tick_gen;
+         ctick.broadcast();
+         while (pending && !stop)
+            cdone.wait(m);
+         if (stop)
+            break;
+
+         out.swap(outbox);
+      }
+
+      // skip ticks that were missed if processing took too long
+      next += tick_ns;
+      int64 mono = pc_monotonic_ns();
+      if (next <= mono)
+         next = mono + tick_ns;
+
+      // send one message per listener queue with the events from all caches
+      ExceptionSink xsink;
+      for (pcoutbox_t::iterator i = out.begin(), e = out.end(); i != e; ++i) {
+         i->first->pushAndTakeRef(i->second);
+         i->first->deref(&xsink);
+      }
    }
 
    AutoLocker al(m);
+   stopWorkers();
+   // release listener events from a tick interrupted by the shutdown
+   ExceptionSink xsink;
+   for (pcoutbox_t::iterator i = outbox.begin(), e = outbox.end(); i != e; ++i) {
+      i->second->deref(&xsink);
+      i->first->deref(&xsink);
+   }
+   outbox.clear();
    running = false;
-   cstop.signal();
+   cstop.broadcast();
+}
+
+void PerformanceCacheManager::runShard(PerformanceCacheShard& shard) {
+   // the coordinator may start the first tick before this thread runs
+   unsigned gen = shard.start_gen;
+
+   while (true) {
+      int64 now;
+      {
+         AutoLocker al(m);
+         while (gen == tick_gen && !stop)
+            ctick.wait(m);
+         // a started tick is always processed, so the coordinator never waits on a stopped worker
+         if (gen == tick_gen)
+            break;
+         gen = tick_gen;
+         now = tick_now;
+      }
+
+      processShard(shard, now);
+
+      AutoLocker al(m);
+      // merge listener events into the manager's outbox
+      ExceptionSink xsink;
+      for (pcoutbox_t::iterator i = shard.outbox.begin(), e = shard.outbox.end(); i != e; ++i) {
+         pcoutbox_t::iterator oi = outbox.lower_bound(i->first);
+         if (oi == outbox.end() || oi->first != i->first) {
+            outbox.insert(oi, *i);
+            continue;
+         }
+         ConstListIterator li(i->second);
+         while (li.next())
+            oi->second->push(li.getReferencedValue(), nullptr);
+         i->second->deref(&xsink);
+         i->first->deref(&xsink);
+      }
+      shard.outbox.clear();
+
+      if (!--pending)
+         cdone.signal();
+   }
+
+   AutoLocker al(m);
+   --workers;
+   cstop.broadcast();
+}
+
+void PerformanceCacheManager::processShard(PerformanceCacheShard& shard, int64 now) {
+   PerformanceCache* pc = shard.takeAll();
+   while (pc) {
+      PerformanceCache* next = pc->getNextDirty();
+      if (pc->pop(now, shard.outbox))
+         pc->requeue();
+      else
+         pc->deref();
+      pc = next;
+   }
+}
+
+void PerformanceCacheManager::stopWorkers() {
+   stop = true;
+   ctick.broadcast();
+   while (workers)
+      cstop.wait(m);
+}
+
+void PerformanceCacheManager::clearDirty() {
+   for (unsigned i = 0; i < shards.size(); ++i) {
+      PerformanceCache* pc = shards[i]->takeAll();
+      while (pc) {
+         PerformanceCache* next = pc->getNextDirty();
+         pc->deref();
+         pc = next;
+      }
+   }
 }
 
 namespace {
@@ -39,6 +181,13 @@ namespace {
       pthread_exit(0);
       return 0;
    }
+
+   extern "C" void* pcache_shard_run(void* arg) {
+      PerformanceCacheShard* shard = (PerformanceCacheShard*)arg;
+      shard->pcm->runShard(*shard);
+      pthread_exit(0);
+      return 0;
+   }
 }
 
 int PerformanceCacheManager::start(ExceptionSink* xsink) {
@@ -47,33 +196,54 @@ int PerformanceCacheManager::start(ExceptionSink* xsink) {
 
    pthread_t ptid;
 
+   AutoLocker al(m);
+
+   for (unsigned i = 0; i < shards.size(); ++i) {
+      shards[i]->start_gen = tick_gen;
+      int rc = pthread_create(&ptid, 0, pcache_shard_run, shards[i].get());
+      if (rc) {
+         stopWorkers();
+         xsink->raiseErrnoException("PERFORMANCECACHEMANAGER-THREAD-ERROR", rc, "could not create performance cache manager worker thread: pthread_create() failed");
+         return -1;
+      }
+      pthread_detach(ptid);
+      ++workers;
+   }
+
    running = true;
 
    int rc = pthread_create(&ptid, 0, pcache_man_run, this);
    if (rc) {
       running = false;
+      stopWorkers();
       xsink->raiseErrnoException("PERFORMANCECACHEMANAGER-THREAD-ERROR", rc, "could not create performance cache manager timer thread: pthread_create() failed");
       return -1;
    }
+   pthread_detach(ptid);
 
    return 0;
 }
 
 void PerformanceCacheManager::shutdown(ExceptionSink* xsink) {
-   stop = true;
+   {
+      AutoLocker al(m);
+      stop = true;
 
-   AutoLocker al(m);
+      for (pcmap_t::iterator i = pcmap.begin(), e = pcmap.end(); i != e; ++i) {
+         i->second->stop(xsink);
+         i->second->deref();
+      }
 
-   for (pcmap_t::iterator i = pcmap.begin(), e = pcmap.end(); i != e; ++i) {
-      i->second->stop(xsink);
-      i->second->deref();
-   }
+      pcmap.clear();
 
-   pcmap.clear();
+      cevent.signal();
+      cdone.signal();
+      while (running)
+         cstop.wait(m);
+   }
 
-   cevent.signal();
-   while (running)
-      cstop.wait(m);
+   // release caches left over from the last tick
+   clearDirty();
 }
 
 PerformanceCache* PerformanceCacheManager::add(const QoreStringNode* name) {
@@ -85,6 +255,8 @@ PerformanceCache* PerformanceCacheManager::add(const QoreStringNode* name) {
       // the following PerformanceCache reference is for the object
       pc = new PerformanceCache(name);
       pc->setIndex(pcmap.insert(i, pcmap_t::value_type(pc->getName(), pc)));
+      // caches are assigned to shards round-robin
+      pc->setShard(this, shards[next_shard++ % shards.size()].get());
 
       // the following performance cache reference is for the cache manager
       pc->ref();
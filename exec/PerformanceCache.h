@@ -18,100 +18,104 @@
 
 #include <qore/Qore.h>
 
+#include "LatencyHistogram.h"
+#include "PerformanceHistory.h"
+
 #include <stdint.h>
 
-#include <deque>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <vector>
 
 struct DataPointHistory {
-   // average
-   double avg;
-   // throughput
-   double tp;
-
-   DLLLOCAL DataPointHistory(double a, double t) : avg(a), tp(t) {
-   }
-};
+    // average
+    double avg;
+    // throughput
+    double tp;
+    // samples per second
+    double rate;
+    // latency percentiles and maximum
+    int64 p50, p90, p99, max;
+
+    DLLLOCAL DataPointHistory() : avg(0.0), tp(0.0), rate(0.0), p50(0), p90(0), p99(0), max(0) {
+    }
 
-typedef std::deque<DataPointHistory> dphl_t;
+    // creates the values for a one-second interval
+    DLLLOCAL DataPointHistory(const PerformanceSlot& s) : avg(s.getAverage()), tp(avg > 0.0 ? 3600000000.0 / avg : 0.0),
+            rate((double)s.count), p50(s.p50), p90(s.p90), p99(s.p99), max(s.max) {
+    }
 
-struct DataPoint {
-   int64 v; // value
-   int64 t; // time point (epoch offset)
+    // adds values to the given hash with the given key suffix
+    DLLLOCAL void addTo(QoreHashNode& h, const char* suffix) const {
+        addKey(h, "avg", suffix, avg);
+        addKey(h, "tp", suffix, tp);
+        addKey(h, "rate", suffix, rate);
+        addKey(h, "p50", suffix, p50);
+        addKey(h, "p90", suffix, p90);
+        addKey(h, "p99", suffix, p99);
+        addKey(h, "max", suffix, max);
+    }
 
-   DLLLOCAL DataPoint() : v(0), t(0) {
-   }
+private:
+    DLLLOCAL static void addKey(QoreHashNode& h, const char* key, const char* suffix, QoreValue v) {
+        QoreStringMaker str("%s_%s", key, suffix);
+        h.setKeyValue(str.c_str(), v, nullptr);
+    }
+};
 
-   DLLLOCAL DataPoint(int64 n_v) : v(n_v), t(q_epoch()) {
-   }
+// forward reference to the PerformanceCache class
+class PerformanceCache;
 
-   DLLLOCAL DataPoint(const DataPoint& p) : v(p.v), t(p.t) {
-   }
+typedef safe_dslist<Queue*> qlist_t;
 
-   DLLLOCAL bool isSet() const {
-      return t > 0;
-   }
+// listener events collected in a tick; each queue receives a single list of event hashes per tick
+typedef std::map<Queue*, QoreListNode*> pcoutbox_t;
 
-   DLLLOCAL DataPoint& operator=(const DataPoint& p) {
-      v = p.v;
-      t = p.t;
-      return *this;
-   }
-};
+// adds an event to the given outbox; the reference to the event hash is passed to the outbox
+DLLLOCAL void pc_add_event(pcoutbox_t& out, Queue* q, QoreHashNode* h);
 
-class DataPointList {
-protected:
-    // list type
-    typedef std::deque<DataPoint> dpl_t;
-    dpl_t list;
+class PerformanceCacheManager;
 
-    // running total of values of data point list
-    double sum;
+// a set of performance caches processed by a single worker thread
+struct PerformanceCacheShard {
+    // the owning manager
+    PerformanceCacheManager* pcm;
 
-public:
-    DLLLOCAL DataPointList() : sum(0.0) {
-    }
+    // lock-free stack of referenced caches to be processed in the next tick
+    std::atomic<PerformanceCache*> dirty = {nullptr};
 
-    DLLLOCAL void push(const DataPoint& p) {
-        list.push_back(p);
-        sum += (double)p.v;
-    }
+    // listener events collected by the worker in the current tick
+    pcoutbox_t outbox;
 
-    DLLLOCAL void pop(int64 t) {
-        while (!list.empty()) {
-            dpl_t::iterator i = list.begin();
-            if (i->t > t)
-                break;
-            sum -= (double)i->v;
-            if (sum < 0)
-                sum = 0.0;
-            list.erase(i);
-        }
-    }
+    // the tick generation when the worker was started; set before the worker thread is created
+    unsigned start_gen = 0;
 
-    // get the list's start timestamp or -1 if the list is empty
-    DLLLOCAL int64 getStart() const {
-        return list.empty() ? -1 : list.begin()->t;
+    DLLLOCAL PerformanceCacheShard(PerformanceCacheManager* pcm) : pcm(pcm) {
     }
 
-    // get the list's average value
-    DLLLOCAL double getAverage(double& tp) const {
-        if (list.empty()) {
-            tp = 0.0;
-            return 0.0;
-        }
+    // pushes the cache on the dirty stack; the reference to the cache is passed to the stack
+    DLLLOCAL void push(PerformanceCache* pc);
 
-        double rv = sum / (double)list.size();
-        tp = 3600000000.0 / rv;
-        return rv;
+    // returns all caches on the dirty stack and clears the stack
+    DLLLOCAL PerformanceCache* takeAll() {
+        return dirty.exchange(nullptr, std::memory_order_acquire);
     }
 };
 
-// forward reference to the PerformanceCache class
-class PerformanceCache;
+// maximum number of shards (worker threads) when the number is determined automatically
+#define QORUS_PC_MAX_SHARDS 8
 
-typedef safe_dslist<Queue*> qlist_t;
+// defines the default cycle time for cache updates: 1 second (1000 ms)
+#define QORUS_PC_HZ 1000
+// the minimum cycle time for cache updates in ms
+#define QORUS_PC_MIN_TICK 10
 
+// manages performance caches
+/** a coordinator thread starts a tick on all shards once per cycle; each shard worker processes only the caches that
+    have been posted to since the last tick, that have listeners, or that have history intervals with samples that
+    are not closed yet, then listener events from all shards are sent as one message per listener queue
+*/
 class PerformanceCacheManager : public AbstractPrivateData {
 protected:
     typedef std::map<const char*, PerformanceCache*, ltstr> pcmap_t;
@@ -125,6 +129,23 @@ protected:
     QoreCondition cevent;
     // shutdown condition var
     QoreCondition cstop;
+    // tick start condition var for shard workers
+    QoreCondition ctick;
+    // tick done condition var for the coordinator
+    QoreCondition cdone;
+
+    // cache shards; one worker thread each
+    std::vector<std::unique_ptr<PerformanceCacheShard>> shards;
+
+    // listener events for the current tick from all shards
+    pcoutbox_t outbox;
+
+    int64 tick_ns;          // tick interval in nanoseconds
+    int64 tick_now = 0;     // time of the current tick; see pc_now_ns()
+    unsigned tick_gen = 0;  // current tick generation
+    unsigned pending = 0;   // number of shards still processing the current tick
+    unsigned workers = 0;   // number of running shard worker threads
+    unsigned next_shard = 0; // shard for the next new cache
 
     bool running; // thread running flag
     bool stop;    // stop flag
@@ -133,43 +154,80 @@ protected:
         assert(pcmap.empty());
     }
 
+    // processes all dirty caches in the given shard
+    DLLLOCAL void processShard(PerformanceCacheShard& shard, int64 now);
+
+    // stops all shard worker threads; the lock must be held
+    DLLLOCAL void stopWorkers();
+
+    // releases all caches remaining on dirty stacks
+    DLLLOCAL void clearDirty();
+
 public:
     typedef pcmap_t::iterator iterator;
 
-    DLLLOCAL PerformanceCacheManager() : running(false), stop(false) {
-    }
+    // creates the manager with the given number of shards (0 = automatic) and tick interval in ms
+    DLLLOCAL PerformanceCacheManager(unsigned nshards = 0, unsigned tick_ms = QORUS_PC_HZ);
 
-    // background thread function
+    // background coordinator thread function
     DLLLOCAL void run();
 
+    // shard worker thread function
+    DLLLOCAL void runShard(PerformanceCacheShard& shard);
+
     DLLLOCAL PerformanceCache* add(const QoreStringNode* name);
 
     DLLLOCAL void del(PerformanceCache* pc, ExceptionSink* xsink);
 
-    // starts the performance cache background thread
+    // starts the performance cache background threads
     DLLLOCAL int start(ExceptionSink* xsink);
 
-    // stops the performance cache background thread
+    // stops the performance cache background threads
     // and deletes all the caches
     DLLLOCAL void shutdown(ExceptionSink* xsink);
+
+    DLLLOCAL unsigned getShardCount() const {
+        return shards.size();
+    }
+
+    DLLLOCAL int64 getTickNs() const {
+        return tick_ns;
+    }
 };
 
-// 120 seconds of performance history per cache
+// seconds of performance history sent to new listeners
 #define PERFCACHE_HIST_SIZE 120
 
 class PerformanceCache : public AbstractPrivateData {
 protected:
-    // performance for the last second
-    DataPointList l_onesec;
+    // lock-free accumulator for posted samples; drained on every manager tick
+    PerformanceAccumulator acc;
+
+    // performance history at all resolutions; updated on every manager tick
+    PerformanceHistory hist;
+
+    // performance values for the last second
+    DataPointHistory last;
+    // start of the second for the values in last
+    int64 last_sec = 0;
+
+    // sample counts per tick for sub-second rates
+    PerformanceRate rate;
 
-    // performance history per second; first entry is the earliest second
-    dphl_t l_hist;
+    // the manager and shard processing this cache; null for caches not created by a manager
+    PerformanceCacheManager* pcm = nullptr;
+    PerformanceCacheShard* shard = nullptr;
+
+    // set when the cache is on the shard's dirty stack
+    std::atomic<bool> dirty = {false};
+    // next cache on the dirty stack
+    PerformanceCache* next_dirty = nullptr;
 
     // manager ref count
     QoreReferenceCounter mrc;
 
     // mutex
-    QoreThreadLock m;
+    mutable QoreThreadLock m;
 
     // listener queues
     qlist_t qlist;
@@ -181,22 +239,94 @@ protected:
     QoreStringNode* name;
 
     int64 start;  // the start epoch offset
+    int64 start_ns; // the start time in nanoseconds; see pc_now_ns()
 
     double sum,   // sum total of all sample values
         count;     // total number of samples
 
-    bool running;
+    std::atomic<bool> running;
 
     DLLLOCAL virtual ~PerformanceCache() {
         name->deref();
         assert(qlist.empty());
+        if (pcm) {
+            pcm->deref();
+        }
+    }
+
+    // adds the event for the last second to all listener queues; the lock must be held
+    DLLLOCAL void addEvents(pcoutbox_t& out) {
+        QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+        h->setKeyValue("name", name->stringRefSelf(), 0);
+        last.addTo(*h, "1s");
+
+        //h->setKeyValue("avg_all", new QoreFloatNode(sum / (count ? count : 1)), 0);
+        for (qlist_t::iterator i = qlist.begin(), e = qlist.end(); i != e; ++i) {
+            if (i != qlist.begin())
+                h->ref();
+            pc_add_event(out, *i, h);
+        }
+    }
+
+    // returns the rate in samples per second for the given count in the given window; the window is limited to the
+    // lifetime of the cache
+    DLLLOCAL double getRate(int64 n, int64 from_ns, int64 now_ns) const {
+        if (from_ns < start_ns) {
+            from_ns = start_ns;
+        }
+        return now_ns > from_ns ? (double)n * (double)PC_NS_PER_SEC / (double)(now_ns - from_ns) : 0.0;
+    }
+
+    // adds the values for a closed second to the totals
+    DLLLOCAL void addClosed(const PerformanceSlot& s) {
+        sum += s.sum;
+        count += (double)s.count;
+        last = DataPointHistory(s);
+        last_sec = s.start;
     }
 
 public:
     typedef qlist_t::iterator iterator;
     typedef qlist_t::node_t node_t;
 
-    DLLLOCAL PerformanceCache(const QoreStringNode* n) : name(n->stringRefSelf()), start(q_epoch()), sum(0.0), count(0.0), running(true) {
+    DLLLOCAL PerformanceCache(const QoreStringNode* n) : hist(pc_now_ns() / PC_NS_PER_SEC),
+            name(n->stringRefSelf()), start(q_epoch()), start_ns(pc_now_ns()), sum(0.0), count(0.0), running(true) {
+    }
+
+    // sets the manager and shard for the cache; the manager is referenced for the lifetime of the cache
+    DLLLOCAL void setShard(PerformanceCacheManager* n_pcm, PerformanceCacheShard* n_shard) {
+        n_pcm->ref();
+        pcm = n_pcm;
+        shard = n_shard;
+        // keep sample counts for one second of ticks
+        rate.setCapacity(PC_NS_PER_SEC / n_pcm->getTickNs() + 1);
+    }
+
+    DLLLOCAL PerformanceCache* getNextDirty() const {
+        return next_dirty;
+    }
+
+    DLLLOCAL void setNextDirty(PerformanceCache* pc) {
+        next_dirty = pc;
+    }
+
+    // marks the cache for processing in the next tick; may be called from any thread
+    DLLLOCAL void markDirty() {
+        if (shard && !dirty.load(std::memory_order_relaxed) && !dirty.exchange(true)) {
+            // the reference is released by the shard worker
+            ref();
+            shard->push(this);
+        }
+    }
+
+    // requeues the cache for the next tick after processing; the reference held by the dirty stack is passed on
+    DLLLOCAL void requeue() {
+        if (!dirty.exchange(true)) {
+            shard->push(this);
+        } else {
+            // already requeued by a concurrent post() with its own reference
+            deref();
+        }
     }
 
     DLLLOCAL void setIndex(PerformanceCacheManager::iterator n_pi) {
@@ -213,21 +343,28 @@ public:
 
         AutoLocker al(m);
         qlist.push_back(q);
-
-        // add history values
-        if (!l_hist.empty()) {
+        // listener events are sent on every tick
+        markDirty();
+
+        // add history values; seconds without samples are sent with zero values
+        std::vector<PerformanceSlot> v;
+        int64 now = pc_now_ns() / PC_NS_PER_SEC;
+        hist.get(PerformanceHistory::PH_1S, now - PERFCACHE_HIST_SIZE, now, v);
+        if (!v.empty()) {
             QoreListNode* hl = new QoreListNode(autoTypeInfo);
-            for (dphl_t::const_iterator i = l_hist.begin(), e = l_hist.end(); i != e; ++i) {
-                QoreHashNode* h = new QoreHashNode(autoTypeInfo);
-                h->setKeyValue("avg_1s", i->avg, 0);
-                h->setKeyValue("tp_1s", i->tp, 0);
-                hl->push(h, nullptr);
+            int64 t = v[0].start;
+            for (const PerformanceSlot& s : v) {
+                for (; t <= s.start; ++t) {
+                    QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+                    (t == s.start ? DataPointHistory(s) : DataPointHistory()).addTo(*h, "1s");
+                    hl->push(h, nullptr);
+                }
             }
-            QoreHashNode* hist = new QoreHashNode(autoTypeInfo);
-            hist->setKeyValue("name", name->stringRefSelf(), 0);
-            hist->setKeyValue("hist", hl, 0);
+            QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+            h->setKeyValue("name", name->stringRefSelf(), 0);
+            h->setKeyValue("hist", hl, 0);
             // push history on queue
-            q->pushAndTakeRef(hist);
+            q->pushAndTakeRef(h);
         }
 
         return qlist.last();
@@ -251,52 +388,129 @@ public:
         running = false;
     }
 
+    // posts a sample without locking; may be called from any thread
     DLLLOCAL void post(int64 v) {
         //printd(5, "PerformanceCache::post() this: %p '%s': v: "QLLD"\n", this, name->getBuffer(), v);
 
-        DataPoint p(v);
-
-        AutoLocker al(m);
-        if (!running)
+        if (!running.load(std::memory_order_relaxed))
             return;
 
-        l_onesec.push(p);
-
-        // adjust global cache values
-        sum += v;
-        count += 1.0;
+        acc.post(v);
+        markDirty();
     }
 
-    DLLLOCAL void pop(int64 now) {
-        // calculate times
-        int64 co_onesec = now - 1;
+    // called once per tick by the shard worker for caches on the dirty stack
+    /** @param now_ns the tick time in nanoseconds; see pc_now_ns()
+        @param out the outbox for listener events
+
+        @return true if the cache must be processed again in the next tick
+    */
+    DLLLOCAL bool pop(int64 now_ns, pcoutbox_t& out) {
+        // clear the dirty flag before draining; samples posted after this point mark the cache again
+        dirty.store(false);
 
         AutoLocker al(m);
         //printd(5, "PerformanceCache::pop() this: %p '%s': now: "QLLD" qsize: %d\n", this, name->getBuffer(), now, (int)qlist.size());
 
-        // push event on all listener queues if any
-        if (!qlist.empty()) {
-            QoreHashNode* h = new QoreHashNode(autoTypeInfo);
-            h->setKeyValue("name", name->stringRefSelf(), 0);
-            double tp;
-            double avg = l_onesec.getAverage(tp);
-            h->setKeyValue("avg_1s", avg, 0);
-            h->setKeyValue("tp_1s", tp, 0);
-
-            //h->setKeyValue("avg_all", new QoreFloatNode(sum / (count ? count : 1)), 0);
-            for (qlist_t::iterator i = qlist.begin(), e = qlist.end(); i != e; ++i) {
-                if (i != qlist.begin())
-                    h->ref();
-                (*i)->pushAndTakeRef(h);
+        int64 now = now_ns / PC_NS_PER_SEC;
+
+        // catch up on intervals that ended while the cache was idle
+        const PerformanceSlot* closed;
+        if (hist.roll(now - 1, closed) && closed) {
+            addClosed(*closed);
+        }
+
+        // merge samples posted since the last tick into the current second, then roll up all intervals that
+        // have ended
+        LatencyHistogram& current = hist.getCurrent();
+        uint64_t before = current.getCount();
+        acc.drain(current);
+        if (current.getCount() > before) {
+            rate.add(now_ns, (int64)(current.getCount() - before));
+        }
+        if (hist.roll(now, closed)) {
+            if (closed) {
+                addClosed(*closed);
+            } else {
+                last = DataPointHistory();
+                last_sec = now - 1;
             }
 
-            // add history entry
-            l_hist.push_back(DataPointHistory(avg, tp));
-            if (l_hist.size() > PERFCACHE_HIST_SIZE)
-                l_hist.pop_front();
+            // add event for all listener queues if any
+            if (!qlist.empty()) {
+                addEvents(out);
+            }
+        }
+
+        // idle caches are processed until all intervals with samples have been closed, so history is rolled up on
+        // the tick and not when the next sample is posted
+        return !qlist.empty() || hist.hasOpen();
+    }
+
+    // returns a snapshot of the current performance values
+    DLLLOCAL QoreHashNode* getInfo() const {
+        ReferenceHolder<QoreHashNode> h(new QoreHashNode(autoTypeInfo), nullptr);
+
+        AutoLocker al(m);
+        h->setKeyValue("name", name->stringRefSelf(), nullptr);
+        h->setKeyValue("start", DateTimeNode::makeAbsolute(currentTZ(), start), nullptr);
+        h->setKeyValue("count", (int64)count, nullptr);
+        h->setKeyValue("avg_all", sum / (count ? count : 1), nullptr);
+        // values are only reported for the last second if the cache is active
+        int64 now_ns = pc_now_ns();
+        int64 now = now_ns / PC_NS_PER_SEC;
+        (last_sec + 2 >= now ? last : DataPointHistory()).addTo(**h, "1s");
+
+        // sliding-window rates; the 1 second rate has the resolution of the manager tick
+        h->setKeyValue("rate_1s", getRate(rate.getCount(now_ns - PC_NS_PER_SEC), now_ns - PC_NS_PER_SEC, now_ns),
+            nullptr);
+        h->setKeyValue("rate_10s", getRate(hist.getCount(now - 9), (now - 9) * PC_NS_PER_SEC, now_ns), nullptr);
+        h->setKeyValue("rate_60s", getRate(hist.getCount(now - 59), (now - 59) * PC_NS_PER_SEC, now_ns), nullptr);
+        return h.release();
+    }
+
+    // returns performance history for the given resolution and time range
+    /** @param level the resolution
+        @param from the start of the time range as seconds since the epoch
+        @param to the end of the time range as seconds since the epoch (exclusive)
+
+        @return a hash of lists with one entry for each interval with samples in the given range
+    */
+    DLLLOCAL QoreHashNode* getHistory(unsigned level, int64 from, int64 to) const {
+        std::vector<PerformanceSlot> v;
+        {
+            AutoLocker al(m);
+            hist.get(level, from, to, v);
+        }
+
+        ReferenceHolder<QoreListNode> tl(new QoreListNode(autoTypeInfo), nullptr);
+        ReferenceHolder<QoreListNode> cl(new QoreListNode(autoTypeInfo), nullptr);
+        ReferenceHolder<QoreListNode> avgl(new QoreListNode(autoTypeInfo), nullptr);
+        ReferenceHolder<QoreListNode> p50l(new QoreListNode(autoTypeInfo), nullptr);
+        ReferenceHolder<QoreListNode> p90l(new QoreListNode(autoTypeInfo), nullptr);
+        ReferenceHolder<QoreListNode> p99l(new QoreListNode(autoTypeInfo), nullptr);
+        ReferenceHolder<QoreListNode> maxl(new QoreListNode(autoTypeInfo), nullptr);
+        for (const PerformanceSlot& s : v) {
+            tl->push(DateTimeNode::makeAbsolute(currentTZ(), s.start), nullptr);
+            cl->push(s.count, nullptr);
+            avgl->push(s.getAverage(), nullptr);
+            p50l->push(s.p50, nullptr);
+            p90l->push(s.p90, nullptr);
+            p99l->push(s.p99, nullptr);
+            maxl->push(s.max, nullptr);
         }
 
-        l_onesec.pop(co_onesec);
+        ReferenceHolder<QoreHashNode> h(new QoreHashNode(autoTypeInfo), nullptr);
+        h->setKeyValue("name", name->stringRefSelf(), nullptr);
+        h->setKeyValue("resolution", PerformanceHistory::getPeriod(level), nullptr);
+        h->setKeyValue("start", tl.release(), nullptr);
+        h->setKeyValue("count", cl.release(), nullptr);
+        h->setKeyValue("avg", avgl.release(), nullptr);
+        h->setKeyValue("p50", p50l.release(), nullptr);
+        h->setKeyValue("p90", p90l.release(), nullptr);
+        h->setKeyValue("p99", p99l.release(), nullptr);
+        h->setKeyValue("max", maxl.release(), nullptr);
+        return h.release();
     }
 
     DLLLOCAL const char* getName() const {
@@ -0,0 +1,337 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    PerformanceHistory.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Multi-resolution performance history for performance caches:
+    * samples are collected in an open histogram for the current second
+    * when an interval ends, it is summarized into a fixed-size ring buffer for its resolution and its histogram is
+      merged into the open interval of the next coarser resolution, so percentiles at all resolutions are
+      calculated from the full sample distribution
+    * intervals without samples are not stored, so idle caches use no memory for history
+    * intervals are aligned to UTC epoch boundaries of a clock derived from the monotonic clock, so changes to the
+      system clock while the process runs do not affect interval boundaries or rates
+*/
+
+#ifndef _QORUS_PERFORMANCE_HISTORY_H
+#define _QORUS_PERFORMANCE_HISTORY_H
+
+#include <qore/Qore.h>
+
+#include "LatencyHistogram.h"
+
+#include <time.h>
+
+#include <vector>
+
+// number of history resolutions
+#define PH_LEVELS 4
+
+// nanoseconds per second
+#define PC_NS_PER_SEC 1000000000LL
+
+// returns the monotonic clock in nanoseconds
+DLLLOCAL inline int64 pc_monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64)ts.tv_sec * PC_NS_PER_SEC + ts.tv_nsec;
+}
+
+// returns the current time in nanoseconds since the epoch based on the monotonic clock
+/** the offset to the system clock is determined once per process
+*/
+DLLLOCAL inline int64 pc_now_ns() {
+    static const int64 offset = []() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (int64)ts.tv_sec * PC_NS_PER_SEC + ts.tv_nsec - pc_monotonic_ns();
+    }();
+    return pc_monotonic_ns() + offset;
+}
+
+// summary of a closed history interval
+struct PerformanceSlot {
+    // interval start as seconds since the epoch
+    int64 start;
+    // number of samples
+    int64 count;
+    // sum total of sample values
+    double sum;
+    // latency percentiles and maximum
+    int64 p50, p90, p99, max;
+
+    DLLLOCAL PerformanceSlot() : start(0), count(0), sum(0.0), p50(0), p90(0), p99(0), max(0) {
+    }
+
+    DLLLOCAL PerformanceSlot(int64 s, const LatencyHistogram& h) : start(s), count((int64)h.getCount()),
+            sum(h.getSum()), p50(h.getPercentile(0.5)), p90(h.getPercentile(0.9)), p99(h.getPercentile(0.99)),
+            max(h.getMax()) {
+    }
+
+    DLLLOCAL double getAverage() const {
+        return count ? sum / (double)count : 0.0;
+    }
+};
+
+// fixed-size ring buffer of history intervals; the oldest entry is overwritten when full
+class PerformanceRing {
+public:
+    DLLLOCAL PerformanceRing(unsigned cap) : cap(cap) {
+    }
+
+    DLLLOCAL void push(const PerformanceSlot& s) {
+        if (slots.size() < cap) {
+            if (slots.empty()) {
+                slots.reserve(cap);
+            }
+            slots.push_back(s);
+            return;
+        }
+        slots[head] = s;
+        head = (head + 1) % cap;
+    }
+
+    DLLLOCAL size_t size() const {
+        return slots.size();
+    }
+
+    // returns the given entry; 0 is the oldest entry
+    DLLLOCAL const PerformanceSlot& operator[](size_t i) const {
+        assert(i < slots.size());
+        return slots[(head + i) % slots.size()];
+    }
+
+private:
+    std::vector<PerformanceSlot> slots;
+    // index of the oldest entry when the buffer is full
+    size_t head = 0;
+    // maximum number of entries
+    unsigned cap;
+};
+
+// sample counts for recent manager ticks for sub-second sliding-window rates; ticks without samples are not stored
+class PerformanceRate {
+public:
+    // sets the maximum number of ticks retained
+    DLLLOCAL void setCapacity(unsigned n_cap) {
+        assert(ticks.empty());
+        cap = n_cap;
+    }
+
+    // adds the number of samples processed in the tick at the given time
+    DLLLOCAL void add(int64 ns, int64 count) {
+        if (ticks.size() < cap) {
+            if (ticks.empty()) {
+                ticks.reserve(cap);
+            }
+            ticks.push_back(TickCount{ns, count});
+            return;
+        }
+        if (!cap) {
+            return;
+        }
+        ticks[head] = TickCount{ns, count};
+        head = (head + 1) % cap;
+    }
+
+    // returns the number of samples processed in ticks after the given time
+    DLLLOCAL int64 getCount(int64 from_ns) const {
+        int64 rv = 0;
+        for (size_t i = 0, e = ticks.size(); i < e; ++i) {
+            const TickCount& t = ticks[(head + e - 1 - i) % e];
+            if (t.ns <= from_ns) {
+                break;
+            }
+            rv += t.count;
+        }
+        return rv;
+    }
+
+private:
+    struct TickCount {
+        int64 ns;
+        int64 count;
+    };
+
+    std::vector<TickCount> ticks;
+    // index of the oldest entry when the buffer is full
+    size_t head = 0;
+    // maximum number of entries
+    unsigned cap = 0;
+};
+
+class PerformanceHistory {
+public:
+    // history resolutions
+    enum Level : unsigned {
+        PH_1S = 0,
+        PH_1M = 1,
+        PH_1H = 2,
+        PH_1D = 3,
+    };
+
+    // creates the history with intervals starting at the given time in seconds since the epoch
+    DLLLOCAL PerformanceHistory(int64 now) : levels{{getCapacity(PH_1S)}, {getCapacity(PH_1M)},
+            {getCapacity(PH_1H)}, {getCapacity(PH_1D)}} {
+        for (unsigned i = 0; i < PH_LEVELS; ++i) {
+            levels[i].start = now - now % getPeriod(i);
+        }
+    }
+
+    // returns the interval length in seconds for the given resolution
+    DLLLOCAL static int64 getPeriod(unsigned level) {
+        static const int64 periods[PH_LEVELS] = {1, 60, 3600, 86400};
+        assert(level < PH_LEVELS);
+        return periods[level];
+    }
+
+    // returns the number of closed intervals retained for the given resolution
+    DLLLOCAL static unsigned getCapacity(unsigned level) {
+        // 2 minutes, 2 hours, 2 days, 1 month
+        static const unsigned caps[PH_LEVELS] = {120, 120, 48, 31};
+        assert(level < PH_LEVELS);
+        return caps[level];
+    }
+
+    // returns the resolution name for the given resolution
+    DLLLOCAL static const char* getName(unsigned level) {
+        static const char* names[PH_LEVELS] = {"1s", "1m", "1h", "1d"};
+        assert(level < PH_LEVELS);
+        return names[level];
+    }
+
+    // returns the resolution for the given name or -1 if the name is not known
+    DLLLOCAL static int getLevel(const char* name) {
+        for (unsigned i = 0; i < PH_LEVELS; ++i) {
+            if (!strcmp(name, getName(i))) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    // returns the number of samples in seconds starting at or after the given time, including the current second
+    DLLLOCAL int64 getCount(int64 from) const {
+        const Interval& l = levels[PH_1S];
+        int64 rv = l.start >= from ? (int64)l.open.getCount() : 0;
+        for (size_t i = l.ring.size(); i; --i) {
+            const PerformanceSlot& s = l.ring[i - 1];
+            if (s.start < from) {
+                break;
+            }
+            rv += s.count;
+        }
+        return rv;
+    }
+
+    // returns true if any open interval has samples that have not been rolled up into a closed interval
+    DLLLOCAL bool hasOpen() const {
+        for (unsigned i = 0; i < PH_LEVELS; ++i) {
+            if (!levels[i].open.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // returns the histogram for the current second where new samples should be added
+    DLLLOCAL LatencyHistogram& getCurrent() {
+        return levels[PH_1S].open;
+    }
+
+    // closes all intervals that ended before the given time
+    /** @param now the current time as seconds since the epoch
+        @param closed set to the summary of the last second if it had samples, otherwise nullptr
+
+        @return true if a new second started, false if not
+    */
+    DLLLOCAL bool roll(int64 now, const PerformanceSlot*& closed) {
+        int64 start = levels[PH_1S].start;
+        closed = nullptr;
+        for (unsigned i = 0; i < PH_LEVELS; ++i) {
+            if (roll(i, now) && !i) {
+                closed = &levels[PH_1S].ring[levels[PH_1S].ring.size() - 1];
+            }
+        }
+        return start != levels[PH_1S].start;
+    }
+
+    // appends all intervals with samples for the given resolution in the given time range to the given vector
+    /** the interval currently being collected is included if it has samples; it is always the last entry
+    */
+    DLLLOCAL void get(unsigned level, int64 from, int64 to, std::vector<PerformanceSlot>& rv) const {
+        assert(level < PH_LEVELS);
+        const Interval& l = levels[level];
+        for (size_t i = 0, e = l.ring.size(); i < e; ++i) {
+            const PerformanceSlot& s = l.ring[i];
+            if (s.start >= to) {
+                return;
+            }
+            if (s.start + getPeriod(level) > from) {
+                rv.push_back(s);
+            }
+        }
+        if (l.start >= to || l.start + getPeriod(level) <= from) {
+            return;
+        }
+        // the open intervals of finer resolutions have not been merged into this one yet
+        LatencyHistogram h(l.open);
+        for (unsigned i = 0; i < level; ++i) {
+            h.merge(levels[i].open);
+        }
+        if (!h.empty()) {
+            rv.push_back(PerformanceSlot(l.start, h));
+        }
+    }
+
+private:
+    struct Interval {
+        // samples for the interval currently being collected
+        LatencyHistogram open;
+        // start of the interval currently being collected
+        int64 start = 0;
+        // closed intervals
+        PerformanceRing ring;
+
+        DLLLOCAL Interval(unsigned cap) : ring(cap) {
+        }
+    };
+
+    Interval levels[PH_LEVELS];
+
+    // closes the open interval for the given resolution if the given time is outside it; returns true if an
+    // interval with samples was closed
+    DLLLOCAL bool roll(unsigned level, int64 t) {
+        Interval& l = levels[level];
+        int64 start = t - t % getPeriod(level);
+        // the system clock may be set backwards; samples are then added to the current interval
+        if (start <= l.start) {
+            return false;
+        }
+        bool rv = false;
+        if (!l.open.empty()) {
+            l.ring.push(PerformanceSlot(l.start, l.open));
+            if (level + 1 < PH_LEVELS) {
+                roll(level + 1, l.start);
+                levels[level + 1].open.merge(l.open);
+            }
+            l.open.clear();
+            rv = true;
+        }
+        l.start = start;
+        return rv;
+    }
+};
+
+#endif
@@ -0,0 +1,332 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QC_CronSchedule.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Native cron schedule with the following properties:
+    * each field (minute, hour, day of the month, month, day of the week) is stored as a bitset, so the next matching
+      value of a field is found with a single bit scan
+    * the next trigger time is found by searching forward in local wall-clock time; each step either returns a
+      result or moves to the start of the next hour, day or month; individual minutes are only visited for
+      wall-clock times around DST transitions
+    * the day of the month and the day of the week are combined as in CronTrigger: if both are restricted, a day
+      matching either field matches; if only one is restricted, only that field is used
+    * wall-clock times are converted to UTC with the time zone of the starting time:
+      - wall-clock times skipped when DST starts do not trigger
+      - wall-clock times repeated when DST ends trigger once, at the first occurrence, unless the schedule matches
+        every hour, in which case both occurrences trigger
+    * schedules that can never trigger (ex: Feb 30) are rejected when created
+*/
+
+#ifndef _QORUS_CRON_SCHEDULE_H
+#define _QORUS_CRON_SCHEDULE_H
+
+#include <stdint.h>
+
+// seconds per day
+#define CS_SECS_PER_DAY 86400LL
+
+// bitsets with all values set
+#define CS_ALL_MINUTES 0x0fffffffffffffffULL
+#define CS_ALL_HOURS 0x00ffffffU
+#define CS_ALL_DAYS 0xfffffffeU
+#define CS_ALL_MONTHS 0x1ffeU
+#define CS_ALL_DOW 0x7fU
+
+class CronSchedule : public AbstractPrivateData {
+public:
+    // field indexes for set()
+    enum Field : unsigned {
+        CS_MINUTE = 0,
+        CS_HOUR = 1,
+        CS_DAY = 2,
+        CS_MONTH = 3,
+        CS_DOW = 4,
+    };
+
+    // adds a value to the given field; raises an exception and returns -1 if the value is out of range
+    DLLLOCAL int set(Field f, int64 v, ExceptionSink* xsink) {
+        static const char* names[] = {"minutes", "hours", "days", "months", "day of the week"};
+        static const int64 mins[] = {0, 0, 1, 1, 0};
+        static const int64 maxs[] = {59, 23, 31, 12, 7};
+        if (v < mins[f] || v > maxs[f]) {
+            xsink->raiseException("CRONSCHEDULE-ERROR", "%s: value (%lld) is outside the valid range (%lld - %lld)",
+                names[f], v, mins[f], maxs[f]);
+            return -1;
+        }
+        switch (f) {
+            case CS_MINUTE: minutes |= (1ULL << v); break;
+            case CS_HOUR: hours |= (1U << v); break;
+            case CS_DAY: days |= (1U << v); break;
+            case CS_MONTH: months |= (uint16_t)(1U << v); break;
+            // 7 is also Sunday
+            case CS_DOW: dow |= (uint8_t)(1U << (v % 7)); break;
+        }
+        return 0;
+    }
+
+    // verifies that the schedule can trigger; raises an exception and returns -1 if not
+    DLLLOCAL int check(ExceptionSink* xsink) const {
+        if (!minutes || !hours || !days || !months || !dow) {
+            xsink->raiseException("CRONSCHEDULE-ERROR", "illegal empty range set");
+            return -1;
+        }
+        // with a restricted day of the week, every month has matching days
+        if (dow != CS_ALL_DOW && days != CS_ALL_DAYS) {
+            return 0;
+        }
+        for (unsigned m = 1; m <= 12; ++m) {
+            // February 29th is possible in leap years
+            if ((months & (1U << m)) && (getDayMask(m == 2 ? 29 : getDaysInMonth(2001, m)) & days)) {
+                return 0;
+            }
+        }
+        xsink->raiseException("CRONSCHEDULE-ERROR", "the schedule contains no valid date");
+        return -1;
+    }
+
+    // returns the first trigger time on or after the given time in seconds since the epoch
+    /** @param after the start time as seconds since the epoch; a time that is not on a minute boundary is rounded
+        up to the next minute
+        @param zone the time zone for wall-clock times
+    */
+    DLLLOCAL int64 next(int64 after, const AbstractQoreZoneInfo* zone) const {
+        int64 rv = find(after, zone);
+
+        // if the clock is set back in the next day, wall-clock times before the transition may repeat after it;
+        // in this case a result after the transition is searched again from the transition
+        int off = getOffset(zone, after);
+        if (getOffset(zone, after + CS_SECS_PER_DAY) < off) {
+            int64 lo = after, hi = after + CS_SECS_PER_DAY;
+            while (hi - lo > 1) {
+                int64 mid = lo + (hi - lo) / 2;
+                if (getOffset(zone, mid) == off) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (rv >= hi) {
+                rv = find(hi, zone);
+            }
+        }
+        return rv;
+    }
+
+    // returns the first matching wall-clock time on or after the given wall-clock time on a minute boundary
+    /** wall-clock times are given as seconds since the epoch in UTC; the schedule must have passed check()
+    */
+    DLLLOCAL int64 nextWall(int64 wall) const {
+        int64 dn = floorDiv(wall, CS_SECS_PER_DAY);
+        int secs = (int)(wall - dn * CS_SECS_PER_DAY);
+        int y;
+        unsigned m, d;
+        civilFromDays(dn, y, m, d);
+        unsigned h = secs / 3600;
+        unsigned mi = (secs % 3600) / 60;
+
+        while (true) {
+            // find the month
+            uint32_t mm = (uint32_t)months & ~((1U << m) - 1);
+            if (!mm) {
+                ++y;
+                mm = months;
+            }
+            unsigned nm = ctz(mm);
+            if (nm != m) {
+                m = nm;
+                d = 1;
+                h = mi = 0;
+            }
+
+            // find the day
+            uint64_t dm = getMonthDays(y, m) & ~((1ULL << d) - 1);
+            if (!dm) {
+                nextMonth(y, m, d, h, mi);
+                continue;
+            }
+            unsigned nd = ctz(dm);
+            if (nd != d) {
+                d = nd;
+                h = mi = 0;
+            }
+
+            // find the hour
+            uint32_t hm = hours & ~((1U << h) - 1);
+            if (!hm) {
+                ++d;
+                h = mi = 0;
+                continue;
+            }
+            unsigned nh = ctz(hm);
+            if (nh != h) {
+                h = nh;
+                mi = 0;
+            }
+
+            // find the minute
+            uint64_t mim = minutes & ~((1ULL << mi) - 1);
+            if (!mim) {
+                ++h;
+                mi = 0;
+                continue;
+            }
+            mi = ctz(mim);
+
+            return daysFromCivil(y, m, d) * CS_SECS_PER_DAY + h * 3600 + mi * 60;
+        }
+    }
+
+    // returns the number of days in the given month
+    DLLLOCAL static unsigned getDaysInMonth(int y, unsigned m) {
+        static const unsigned dim[] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        if (m == 2 && !(y % 4) && ((y % 100) || !(y % 400))) {
+            return 29;
+        }
+        return dim[m];
+    }
+
+    // returns days since the epoch for the given date in the proleptic Gregorian calendar
+    DLLLOCAL static int64 daysFromCivil(int y, unsigned m, unsigned d) {
+        y -= m <= 2;
+        int64 era = (y >= 0 ? y : y - 399) / 400;
+        unsigned yoe = (unsigned)(y - era * 400);
+        unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + (int64)doe - 719468;
+    }
+
+    // returns the date for the given number of days since the epoch in the proleptic Gregorian calendar
+    DLLLOCAL static void civilFromDays(int64 z, int& y, unsigned& m, unsigned& d) {
+        z += 719468;
+        int64 era = (z >= 0 ? z : z - 146096) / 146097;
+        unsigned doe = (unsigned)(z - era * 146097);
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        d = doy - (153 * mp + 2) / 5 + 1;
+        m = mp < 10 ? mp + 3 : mp - 9;
+        y = (int)(yoe + era * 400) + (m <= 2);
+    }
+
+private:
+    // bit n is set for each matching value n
+    uint64_t minutes = 0;
+    uint32_t hours = 0;
+    uint32_t days = 0;
+    uint16_t months = 0;
+    // 0 = Sunday
+    uint8_t dow = 0;
+
+    // returns the first trigger time on or after the given time, searching forward in wall-clock time from the
+    // local time of the given time
+    DLLLOCAL int64 find(int64 after, const AbstractQoreZoneInfo* zone) const {
+        int64 wall = after + getOffset(zone, after);
+        // round up to the next minute
+        int64 r = floorMod(wall, 60);
+        if (r) {
+            wall += 60 - r;
+        }
+
+        while (true) {
+            wall = nextWall(wall);
+
+            // the UTC offsets before and after any DST transition near the wall-clock time
+            int off_early = getOffset(zone, wall - CS_SECS_PER_DAY);
+            int off_late = getOffset(zone, wall + CS_SECS_PER_DAY);
+
+            // the first occurrence of the wall-clock time; with more than one occurrence, the earlier one is
+            // the one with the larger UTC offset
+            int off1 = off_early > off_late ? off_early : off_late;
+            int off2 = off_early > off_late ? off_late : off_early;
+
+            bool valid1 = getOffset(zone, wall - off1) == off1;
+            if (valid1 && wall - off1 >= after) {
+                return wall - off1;
+            }
+            // the second occurrence only triggers for schedules that match every hour
+            if (off2 != off1 && (!valid1 || hours == CS_ALL_HOURS)) {
+                int64 t = wall - off2;
+                if (getOffset(zone, t) == off2 && t >= after) {
+                    return t;
+                }
+            }
+            // the wall-clock time does not exist or has already passed; continue with the next minute
+            wall += 60;
+        }
+    }
+
+    DLLLOCAL static unsigned ctz(uint64_t v) {
+        assert(v);
+        return (unsigned)__builtin_ctzll(v);
+    }
+
+    DLLLOCAL static int64 floorDiv(int64 a, int64 b) {
+        int64 q = a / b;
+        return (a % b) < 0 ? q - 1 : q;
+    }
+
+    DLLLOCAL static int64 floorMod(int64 a, int64 b) {
+        return a - floorDiv(a, b) * b;
+    }
+
+    // returns the UTC offset in seconds east of UTC in the given zone at the given time
+    DLLLOCAL static int getOffset(const AbstractQoreZoneInfo* zone, int64 t) {
+        bool is_dst;
+        const char* zname;
+        return tz_get_utc_offset(zone, t, is_dst, zname);
+    }
+
+    // returns a bitset with bits 1 - n set
+    DLLLOCAL static uint64_t getDayMask(unsigned n) {
+        return ((1ULL << (n + 1)) - 1) & ~1ULL;
+    }
+
+    // returns a bitset of the matching days of the given month
+    DLLLOCAL uint64_t getMonthDays(int y, unsigned m) const {
+        uint64_t valid = getDayMask(getDaysInMonth(y, m));
+        if (dow == CS_ALL_DOW) {
+            return days & valid;
+        }
+
+        // every 7th day starting with day 0
+        static const uint64_t weekly = 0x810204081ULL;
+        // the day of the week of the first day of the month; the epoch was a Thursday
+        unsigned wd1 = (unsigned)floorMod(daysFromCivil(y, m, 1) + 4, 7);
+        uint64_t dm = 0;
+        for (unsigned w = 0; w < 7; ++w) {
+            if (dow & (1U << w)) {
+                dm |= weekly << (1 + (w + 7 - wd1) % 7);
+            }
+        }
+        if (days != CS_ALL_DAYS) {
+            dm |= days;
+        }
+        return dm & valid;
+    }
+
+    DLLLOCAL static void nextMonth(int& y, unsigned& m, unsigned& d, unsigned& h, unsigned& mi) {
+        if (++m > 12) {
+            m = 1;
+            ++y;
+        }
+        d = 1;
+        h = mi = 0;
+    }
+};
+
+DLLLOCAL extern qore_classid_t CID_CRONSCHEDULE;
+DLLLOCAL QoreClass* initCronScheduleClass(QoreNamespace& ns);
+
+#endif
@@ -0,0 +1,26 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QC_JobScheduler.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+#ifndef _QORUS_QC_JOBSCHEDULER_H
+#define _QORUS_QC_JOBSCHEDULER_H
+
+#include <qore/Qore.h>
+
+#include "JobScheduler.h"
+
+DLLLOCAL extern qore_classid_t CID_JOBSCHEDULER;
+DLLLOCAL QoreClass* initJobSchedulerClass(QoreNamespace& ns);
+
+#endif
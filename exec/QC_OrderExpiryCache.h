@@ -18,9 +18,15 @@
     * data entries are workflow order instance IDs with their created time
     * the cache has workflow-specific TTLs that apply to all data entries of its class (= workflowid)
     * the TTL is based on the entry to the cache; entries are placed in each cache in the order they are submitted
-    * any particular data entry may be removed from the cache at any time; the cache must support fast deletion
+    * any particular data entry may be removed from the cache at any time; the cache must support fast deletion:
+      each workflow has an index of wfiid -> position, and removed entries are marked as tombstones in place; tombstones
+      are dropped when they reach the front of the queue in getEvents(), which also compacts queues that consist
+      mostly of tombstones
     * all entries for a particular class (workflow ID) may be requeued at any time: the cache must support
-      fast requeuing of all entries belonging to a particular class ID
+      fast requeuing of all entries belonging to a particular class ID; the TTL for each class is kept in a native
+      table, and because all entries of a class share the same TTL and are ordered by creation time, changing the
+      TTL only requires updating the table: entries are evaluated against the new TTL in the next getEvents() call
+    * live entries can be saved to a checkpoint file and loaded on restart; SLA thresholds are not saved
 */
 
 #ifndef _QORUS_ORDER_EXPIRY_CACHE_H
@@ -29,10 +35,22 @@
 // default SLA threshold is 30 minutes
 #define DEFAULT_SLA_THRESHOLD 1800
 
+// queues with at least this many entries are compacted when less than half of the entries are live
+#define OEC_COMPACT_MIN 1024
+
+// checkpoint file magic value ("QOEC") and format version
+#define OEC_CHECKPOINT_MAGIC 0x43454f51
+#define OEC_CHECKPOINT_VERSION 1
+
 #include <deque>
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 #include <inttypes.h>
+#include <stdlib.h>
+
+#include "QorusCheckpointFile.h"
 
 class OrderExpiryCache : public AbstractPrivateData {
 public:
@@ -42,9 +60,51 @@ public:
         queueOrderUnlocked(wfid, wfiid, created);
     }
 
-    // wf_slas is a hash keyed by wfid -> (int) sla threshold in seconds
+    // sets the SLA threshold in seconds for the given workflow
+    DLLLOCAL void setSla(int64 wfid, int64 sla) {
+        AutoLocker al(lck);
+        slas[wfid] = sla;
+    }
+
+    // sets SLA thresholds from a hash of wfid -> (int) sla threshold in seconds
+    /** if replace is true, then all SLA thresholds not in the hash are removed
+    */
+    DLLLOCAL void setSlas(const QoreHashNode* wf_slas, bool replace) {
+        AutoLocker al(lck);
+        if (replace) {
+            slas.clear();
+        }
+        ConstHashIterator hi(wf_slas);
+        while (hi.next()) {
+            slas[strtoll(hi.getKey(), nullptr, 10)] = hi.get().getAsBigInt();
+        }
+    }
+
+    // removes the SLA threshold for the given workflow
+    DLLLOCAL void removeSla(int64 wfid) {
+        AutoLocker al(lck);
+        slas.erase(wfid);
+    }
+
+    // returns the SLA threshold in seconds for the given workflow
+    DLLLOCAL int64 getSla(int64 wfid) const {
+        AutoLocker al(lck);
+        return getSlaUnlocked(wfid);
+    }
+
+    // sets the SLA threshold for the given workflow; returns the number of orders queued for the workflow
+    /** queued orders are evaluated against the new threshold in the next call to getEvents()
+    */
+    DLLLOCAL int64 requeue(int64 wfid, int64 sla) {
+        AutoLocker al(lck);
+        slas[wfid] = sla;
+
+        cache_t::const_iterator i = cache.find(wfid);
+        return i == cache.end() ? 0 : (int64)i->second.index.size();
+    }
+
     // returns as *hash<string, int> of wfid -> count
-    DLLLOCAL QoreHashNode* getEvents(const QoreHashNode* wf_slas, int64 delay) {
+    DLLLOCAL QoreHashNode* getEvents(int64 delay) {
         int64 now = q_epoch();
 
         ReferenceHolder<QoreHashNode> rv(nullptr);
@@ -55,56 +115,45 @@ public:
         for (cache_t::iterator i = cache.begin(), e = cache.end(); i != e;) {
             int64 wfid = i->first;
 
-            // get expiry in seconds
-            int64 seconds;
-            if (wf_slas) {
-                QoreStringMaker wf_str(QLLD, wfid);
-                seconds = wf_slas->getKeyValue(wf_str.c_str()).getAsBigInt();
-                //printd(5, "getEvents() wfid: %d ('%s' wf_sla size: %d) seconds: %d\n", static_cast<int>(wfid), wf_str.c_str(), static_cast<int>(wf_slas->size()), static_cast<int>(seconds));
-                if (!seconds) {
-                    seconds = DEFAULT_SLA_THRESHOLD;
+            // get expiry in seconds; add a buffer to address race conditions
+            int64 seconds = getSlaUnlocked(wfid) + delay;
+
+            WorkflowOrders& wo = i->second;
+            int64 expired = 0;
+            // drop expired entries and tombstones from the front of the queue
+            while (!wo.q.empty()) {
+                const OrderEntry& oe = wo.q.front();
+                if (oe.wfiid) {
+                    if ((now - oe.created) < seconds) {
+                        break;
+                    }
+                    wo.index.erase(oe.wfiid);
+                    ++expired;
                 }
+                wo.q.pop_front();
+                ++wo.base;
             }
-            else {
-                seconds = DEFAULT_SLA_THRESHOLD;
-                //printd(5, "getEvents() wfid: %d wf_slas empty\n", static_cast<int>(wfid));
-            }
-            // add a buffer to address race conditions
-            seconds += delay;
-
-            size_t offset = 0;
-            while (true) {
-                /*
-                printd(5, "getEvents() wfid: %d seconds: %d offset: %d now: %d size: %d entry: %d (%d)\n",
-                    static_cast<int>(wfid), static_cast<int>(seconds), static_cast<int>(offset),
-                    static_cast<int>(now), static_cast<int>(i->second.size()), offset != i->second.size() ? i->second[offset].second : 0,
-                    offset != i->second.size() ? now - i->second[offset].second : 0);
-                */
-                if (offset == i->second.size()
-                    || ((now - i->second[offset].second) < seconds)) {
-                    break;
-                }
 
-                ++offset;
-            }
-            if (offset) {
+            if (expired) {
                 // first write result to hash
                 if (!rv) {
                     rv = new QoreHashNode(bigIntTypeInfo);
                 }
 
                 QoreStringMaker wfid_str(QLLD, wfid);
-                rv->setKeyValue(wfid_str.c_str(), offset, nullptr);
-
-                // remove entries from list
-                i->second.erase(i->second.begin(), i->second.begin() + offset);
-                // remove workflow from map if there are no more entries
-                if (i->second.empty()) {
-                    cache_t::iterator j = i;
-                    ++i;
-                    cache.erase(j);
-                    continue;
-                }
+                rv->setKeyValue(wfid_str.c_str(), expired, nullptr);
+            }
+
+            // remove workflow from map if there are no more entries
+            if (wo.index.empty()) {
+                cache_t::iterator j = i;
+                ++i;
+                cache.erase(j);
+                continue;
+            }
+
+            if (wo.q.size() >= OEC_COMPACT_MIN && wo.q.size() > (wo.index.size() * 2)) {
+                wo.compact();
             }
             ++i;
         }
@@ -113,7 +162,7 @@ public:
     }
 
     // returns 0 = deleted, -1 = not found
-    int removeOrder(int64 wfid, int64 wfiid) {
+    DLLLOCAL int removeOrder(int64 wfid, int64 wfiid) {
         AutoLocker al(lck);
 
         cache_t::iterator i = cache.find(wfid);
@@ -121,15 +170,88 @@ public:
             return 0;
         }
 
-        // we do a linear search here
-        for (order_vec_t::iterator oi = i->second.begin(), oe = i->second.end(); oi != oe; ++oi) {
-            if (oi->first == wfiid) {
-                i->second.erase(oi);
-                return 0;
+        return i->second.remove(wfiid) ? 0 : -1;
+    }
+
+    // removes all queued orders
+    DLLLOCAL void clear() {
+        AutoLocker al(lck);
+        cache.clear();
+    }
+
+    // saves all queued orders to the given checkpoint file; returns the time saved as seconds since the epoch
+    DLLLOCAL int64 save(const char* path, ExceptionSink* xsink) const {
+        int64 now = q_epoch();
+        CheckpointBuffer cb(OEC_CHECKPOINT_MAGIC, OEC_CHECKPOINT_VERSION, now);
+        // copy the orders under the lock; the file is written and synced after the lock has been released
+        {
+            AutoLocker al(lck);
+
+            // workflow count, then for each workflow: wfid, order count, and orders
+            size_t data_size = sizeof(uint64_t);
+            for (auto& i : cache) {
+                data_size += sizeof(int64) + sizeof(uint64_t) + i.second.index.size() * sizeof(OrderEntry);
+            }
+            cb.resize(data_size);
+
+            cb.write((uint64_t)cache.size());
+            for (auto& i : cache) {
+                cb.write(i.first);
+                cb.write((uint64_t)i.second.index.size());
+                for (const OrderEntry& oe : i.second.q) {
+                    if (oe.wfiid) {
+                        cb.write(oe);
+                    }
+                }
             }
         }
 
-        return -1;
+        return cb.save(path, "ORDEREXPIRYCACHE-CHECKPOINT-ERROR", xsink) ? -1 : now;
+    }
+
+    // queues orders from the given checkpoint file; returns the time the file was saved as seconds since the epoch
+    /** no orders are queued if the file is invalid
+    */
+    DLLLOCAL int64 load(const char* path, ExceptionSink* xsink) {
+        CheckpointReader cr(path, OEC_CHECKPOINT_MAGIC, OEC_CHECKPOINT_VERSION, "ORDEREXPIRYCACHE-CHECKPOINT-ERROR",
+            xsink);
+        if (*xsink) {
+            return -1;
+        }
+
+        // read all orders before queuing any
+        std::vector<std::pair<int64, OrderEntry>> orders;
+        uint64_t wcnt;
+        if (cr.read(wcnt)) {
+            cr.invalid(xsink);
+            return -1;
+        }
+        for (uint64_t i = 0; i < wcnt; ++i) {
+            int64 wfid;
+            uint64_t cnt;
+            if (cr.read(wfid) || cr.read(cnt)) {
+                cr.invalid(xsink);
+                return -1;
+            }
+            for (uint64_t j = 0; j < cnt; ++j) {
+                OrderEntry oe;
+                if (cr.read(oe)) {
+                    cr.invalid(xsink);
+                    return -1;
+                }
+                orders.push_back(std::make_pair(wfid, oe));
+            }
+        }
+        if (!cr.atEnd()) {
+            cr.invalid(xsink);
+            return -1;
+        }
+
+        AutoLocker al(lck);
+        for (auto& i : orders) {
+            queueOrderUnlocked(i.first, i.second.wfiid, i.second.created);
+        }
+        return cr.getSaved();
     }
 
     DLLLOCAL QoreStringNode* getSummary() const {
@@ -138,7 +260,7 @@ public:
         AutoLocker al(lck);
 
         for (auto& i : cache) {
-            str->sprintf("wfid %d: size: %d, ", static_cast<int>(i.first), static_cast<int>(i.second.size()));
+            str->sprintf("wfid %d: size: %d, ", static_cast<int>(i.first), static_cast<int>(i.second.index.size()));
         }
 
         if (str->size() > 1) {
@@ -156,11 +278,13 @@ public:
         AutoLocker al(lck);
 
         for (auto& i : cache) {
-            str->sprintf("wfid %d: size: %d: [", static_cast<int>(i.first), static_cast<int>(i.second.size()));
-            for (auto& wi : i.second) {
-                str->sprintf("wfid: " QLLD " created: " QLLD ", ", wi.first, wi.second);
+            str->sprintf("wfid %d: size: %d: [", static_cast<int>(i.first), static_cast<int>(i.second.index.size()));
+            for (auto& wi : i.second.q) {
+                if (wi.wfiid) {
+                    str->sprintf("wfid: " QLLD " created: " QLLD ", ", wi.wfiid, wi.created);
+                }
             }
-            if (i.second.size()) {
+            if (!i.second.index.empty()) {
                 str->terminate(str->size() - 2);
             }
             str->concat("], ");
@@ -176,30 +300,86 @@ public:
     }
 
 protected:
+    DLLLOCAL int64 getSlaUnlocked(int64 wfid) const {
+        sla_map_t::const_iterator i = slas.find(wfid);
+        return i == slas.end() || i->second <= 0 ? DEFAULT_SLA_THRESHOLD : i->second;
+    }
+
     DLLLOCAL void queueOrderUnlocked(int64 wfid, int64 wfiid, int64 created) {
         //printd(5, "queueOrderUnlocked() wfid: %d wfiid: %d created: %d\n", static_cast<int>(wfid), static_cast<int>(wfiid), static_cast<int>(created));
         cache_t::iterator i = cache.find(wfid);
         if (i == cache.end()) {
-            i = cache.insert(cache_t::value_type(wfid, order_vec_t())).first;
+            i = cache.insert(cache_t::value_type(wfid, WorkflowOrders())).first;
         }
 
-        // orders should be placed roughly in order - check for not more than 30 seconds before than the last entry
-        assert(i->second.empty() || (i->second.back().second < created) || ((i->second.back().second - created) < 30));
-        i->second.push_back(order_vec_t::value_type(wfiid, created));
+        i->second.push(wfiid, created);
     }
 
-    // list of orders for a particular workflow tagged with creation time; values are <wfiid, creation time>
-    /** reasons for a deque:
-        * very fast iteration
-        * very efficient memory usage
-        * constant time insertions at the end
-        * constant time removals from the beginning
-    */
-    typedef std::deque<std::pair<int64, int64>> order_vec_t;
+    // an order tagged with its creation time; removed orders are tombstones with a wfiid of 0
+    struct OrderEntry {
+        int64 wfiid;
+        int64 created;
+    };
+
+    // orders for a particular workflow
+    struct WorkflowOrders {
+        // orders in the order they were queued
+        /** reasons for a deque:
+            * very fast iteration
+            * very efficient memory usage
+            * constant time insertions at the end
+            * constant time removals from the beginning
+        */
+        std::deque<OrderEntry> q;
+        // sequence number of the first entry in the queue
+        int64 base = 0;
+        // index of live entries; wfiid -> sequence number
+        std::unordered_map<int64, int64> index;
+
+        DLLLOCAL void push(int64 wfiid, int64 created) {
+            // an order that is queued again replaces the existing entry
+            remove(wfiid);
+
+            // orders should be placed roughly in order - check for not more than 30 seconds before than the last entry
+            assert(q.empty() || (q.back().created < created) || ((q.back().created - created) < 30));
+            index[wfiid] = base + q.size();
+            q.push_back(OrderEntry{wfiid, created});
+        }
+
+        // replaces the entry for the given order with a tombstone; returns false if the order is not present
+        DLLLOCAL bool remove(int64 wfiid) {
+            std::unordered_map<int64, int64>::iterator i = index.find(wfiid);
+            if (i == index.end()) {
+                return false;
+            }
+            OrderEntry& oe = q[i->second - base];
+            assert(oe.wfiid == wfiid);
+            oe.wfiid = 0;
+            index.erase(i);
+            return true;
+        }
+
+        // removes all tombstones from the queue
+        DLLLOCAL void compact() {
+            std::deque<OrderEntry> nq;
+            for (const OrderEntry& oe : q) {
+                if (oe.wfiid) {
+                    index[oe.wfiid] = base + nq.size();
+                    nq.push_back(oe);
+                }
+            }
+            q.swap(nq);
+        }
+    };
+
     // each wf order cache is keyed by its wfid
-    typedef std::map<int64, order_vec_t> cache_t;
+    typedef std::map<int64, WorkflowOrders> cache_t;
     cache_t cache;
 
+    // SLA thresholds in seconds; wfid -> sla
+    typedef std::unordered_map<int64, int64> sla_map_t;
+    sla_map_t slas;
+
     // mutex for cache access
     mutable QoreThreadLock lck;
 };
@@ -0,0 +1,774 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QC_OrderStatsAggregator.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    The order stats aggregator maintains workflow order disposition and SLA statistics for the last 1, 4, and 24
+    hours with bounded memory per workflow:
+    * each workflow has a ring buffer with one slot per minute of the largest band; slots hold disposition counters,
+      in / out of SLA counters, and a duration sketch
+    * ring buffers are allocated in chunks of one hour when the first event for a minute in the chunk is posted, and
+      chunks are released when all of their slots have left the largest band, so memory is proportional to the
+      number of hours with events
+    * band totals are maintained incrementally: samples are added to all bands covering their minute when posted, and
+      slots are subtracted from a band when they leave its window, so the per-second update is constant time per
+      workflow
+    * in / out of SLA counters are exact for the SLA threshold in effect when samples are posted; when the threshold
+      changes, the counters are recalculated from the duration sketches with the resolution of the sketch
+    * statistics for all workflows ("global") are calculated by summing workflow band totals, because workflows have
+      different SLA thresholds
+    * all chunks are released when a workflow has no samples in the largest band
+    * state can be saved to a checkpoint file and loaded on restart; only slots in the largest band are saved, and
+      duration sketches are saved sparsely
+*/
+
+#ifndef _QORUS_ORDER_STATS_AGGREGATOR_H
+#define _QORUS_ORDER_STATS_AGGREGATOR_H
+
+// number of summary bands
+#define OSA_BANDS 3
+// number of slots in the ring buffer; one per minute of the largest band
+#define OSA_SLOTS (24 * 60)
+// number of slots in a ring buffer chunk; one hour
+#define OSA_CHUNK_SLOTS 60
+// number of chunks in the ring buffer
+#define OSA_CHUNKS (OSA_SLOTS / OSA_CHUNK_SLOTS)
+// number of dispositions
+#define OSA_DISPOSITIONS 3
+
+// number of linear sub-buckets for each power of two in duration sketches
+#define OSA_SUB_BUCKETS 4
+// number of powers of two covered by duration sketches: 1s - 2^17s (~36 hours)
+#define OSA_OCTAVES 17
+// duration sketch buckets: one for durations < 1s, the octave buckets, and one for all larger durations
+#define OSA_BUCKETS (OSA_OCTAVES * OSA_SUB_BUCKETS + 2)
+
+// checkpoint file magic value ("QOSA") and format version
+#define OSA_CHECKPOINT_MAGIC 0x41534f51
+#define OSA_CHECKPOINT_VERSION 1
+
+#include "QorusCheckpointFile.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+class OrderStatsAggregator : public AbstractPrivateData {
+public:
+    DLLLOCAL OrderStatsAggregator() : now(q_epoch()) {
+    }
+
+    // returns the length of the given band in hours
+    DLLLOCAL static int64 getBandHours(unsigned band) {
+        static const int64 hours[OSA_BANDS] = {1, 4, 24};
+        assert(band < OSA_BANDS);
+        return hours[band];
+    }
+
+    // returns the disposition index for the given disposition or -1 if not known
+    DLLLOCAL static int getDispositionIndex(const char* disposition) {
+        if (!disposition[0] || disposition[1]) {
+            return -1;
+        }
+        switch (disposition[0]) {
+            case 'C': return 0;
+            case 'A': return 1;
+            case 'M': return 2;
+        }
+        return -1;
+    }
+
+    // returns the duration sketch bucket for the given duration in seconds
+    DLLLOCAL static unsigned getBucket(double duration) {
+        if (duration < 1.0) {
+            return 0;
+        }
+        int e;
+        // duration = m * 2^e with 0.5 <= m < 1
+        double m = frexp(duration, &e);
+        if (e > OSA_OCTAVES) {
+            return OSA_BUCKETS - 1;
+        }
+        return 1 + (e - 1) * OSA_SUB_BUCKETS + (unsigned)((m * 2.0 - 1.0) * OSA_SUB_BUCKETS);
+    }
+
+    // returns the lower bound of the given bucket in seconds
+    DLLLOCAL static double getLowerBound(unsigned bucket) {
+        if (!bucket) {
+            return 0.0;
+        }
+        --bucket;
+        return ldexp(1.0 + (double)(bucket % OSA_SUB_BUCKETS) / OSA_SUB_BUCKETS, bucket / OSA_SUB_BUCKETS);
+    }
+
+    // posts order events for the given workflow
+    /** @param wfid the workflow ID
+        @param disposition the order disposition or an empty string if the order has no final status
+        @param duration the order duration in seconds for SLA statistics; negative values are not included in SLA
+        statistics
+        @param sla the current SLA threshold of the workflow in seconds
+        @param ts the event time in seconds since the epoch
+        @param count the number of orders
+    */
+    DLLLOCAL void post(int64 wfid, const char* disposition, double duration, int64 sla, int64 ts, int64 count) {
+        int disp = getDispositionIndex(disposition);
+        if ((disp < 0 && duration < 0) || count <= 0) {
+            return;
+        }
+
+        int64 minute = floorDiv(ts, 60);
+
+        AutoLocker al(lck);
+
+        WorkflowStats& ws = getStats(wfid, sla);
+        // ignore events that are too old for all bands
+        if (minute <= ws.cutoff[OSA_BANDS - 1]) {
+            return;
+        }
+
+        Slot* s = ws.getSlot(minute);
+        if (!s) {
+            return;
+        }
+
+        BandTotals delta;
+        if (disp >= 0) {
+            delta.disp[disp] = count;
+        }
+        if (duration >= 0) {
+            (duration <= (double)ws.sla ? delta.in : delta.out) = count;
+            s->addSketch(getBucket(duration), count);
+        }
+        s->add(delta);
+        ws.addDelta(minute, delta);
+    }
+
+    // sets the SLA threshold for the given workflow and recalculates in / out of SLA counters
+    DLLLOCAL void requeue(int64 wfid, int64 sla) {
+        AutoLocker al(lck);
+
+        wsmap_t::iterator i = wsmap.find(wfid);
+        if (i != wsmap.end()) {
+            i->second.setSla(sla);
+        }
+    }
+
+    // removes all statistics for the given workflow; returns true if the workflow had statistics
+    DLLLOCAL bool remove(int64 wfid) {
+        AutoLocker al(lck);
+        return wsmap.erase(wfid) > 0;
+    }
+
+    // returns the IDs of all workflows with statistics in ascending order
+    DLLLOCAL QoreListNode* getWorkflowIds() const {
+        ReferenceHolder<QoreListNode> rv(new QoreListNode(bigIntTypeInfo), nullptr);
+        AutoLocker al(lck);
+        for (auto& i : wsmap) {
+            rv->push(i.first, nullptr);
+        }
+        return rv.release();
+    }
+
+    // removes expired slots from all bands
+    DLLLOCAL void advance(int64 n_now) {
+        AutoLocker al(lck);
+        now = n_now;
+
+        for (auto& i : wsmap) {
+            i.second.advance(now);
+        }
+    }
+
+    // returns the summary for the given workflow or for all workflows if wfid is 0
+    /** @return a hash of band -> summary or nullptr if there is no data for the workflow
+    */
+    DLLLOCAL QoreHashNode* getSummary(int64 wfid) const {
+        BandTotals totals[OSA_BANDS];
+        {
+            AutoLocker al(lck);
+            if (wfid) {
+                wsmap_t::const_iterator i = wsmap.find(wfid);
+                if (i == wsmap.end()) {
+                    return nullptr;
+                }
+                memcpy(totals, i->second.totals, sizeof totals);
+            } else {
+                getGlobalTotals(totals);
+            }
+        }
+        return makeSummary(totals);
+    }
+
+    // returns summaries that have changed since the last call
+    /** @return a hash of tag -> band -> summary, where tag is the workflow ID or "global" for all workflows, or
+        nullptr if no summaries have changed
+    */
+    DLLLOCAL QoreHashNode* getChanged() {
+        ReferenceHolder<QoreHashNode> rv(nullptr);
+
+        AutoLocker al(lck);
+
+        BandTotals totals[OSA_BANDS];
+        getGlobalTotals(totals);
+        if (memcmp(totals, global_last, sizeof totals)) {
+            memcpy(global_last, totals, sizeof totals);
+            rv = new QoreHashNode(autoTypeInfo);
+            rv->setKeyValue("global", makeSummary(totals), nullptr);
+        }
+
+        for (auto& i : wsmap) {
+            WorkflowStats& ws = i.second;
+            if (memcmp(ws.totals, ws.last, sizeof ws.totals)) {
+                memcpy(ws.last, ws.totals, sizeof ws.totals);
+                if (!rv) {
+                    rv = new QoreHashNode(autoTypeInfo);
+                }
+                QoreStringMaker wfid_str(QLLD, i.first);
+                rv->setKeyValue(wfid_str.c_str(), makeSummary(ws.totals), nullptr);
+            }
+            // release the ring buffer when there is no more data
+            if (ws.totals[OSA_BANDS - 1].empty()) {
+                ws.release();
+            }
+        }
+
+        return rv.release();
+    }
+
+    // saves all data to the given checkpoint file; returns the time saved as seconds since the epoch
+    DLLLOCAL int64 save(const char* path, ExceptionSink* xsink) const {
+        int64 saved = q_epoch();
+        CheckpointBuffer cb(OSA_CHECKPOINT_MAGIC, OSA_CHECKPOINT_VERSION, saved);
+        // copy the data under the lock; the file is written and synced after the lock has been released
+        {
+            AutoLocker al(lck);
+            copyCheckpoint(cb);
+        }
+
+        return cb.save(path, "ORDERSTATSAGGREGATOR-CHECKPOINT-ERROR", xsink) ? -1 : saved;
+    }
+
+    // adds data from the given checkpoint file; returns the time the file was saved as seconds since the epoch
+    /** no data is added if the file is invalid; data outside the largest band is ignored
+    */
+    DLLLOCAL int64 load(const char* path, ExceptionSink* xsink) {
+        CheckpointReader cr(path, OSA_CHECKPOINT_MAGIC, OSA_CHECKPOINT_VERSION,
+            "ORDERSTATSAGGREGATOR-CHECKPOINT-ERROR", xsink);
+        if (*xsink) {
+            return -1;
+        }
+
+        // read all data before adding any
+        struct SavedSlot {
+            int64 minute;
+            BandTotals totals;
+            std::vector<std::pair<uint8_t, uint32_t>> buckets;
+        };
+        struct SavedStats {
+            int64 wfid;
+            int64 sla;
+            std::vector<SavedSlot> slots;
+        };
+        std::vector<SavedStats> wsl;
+
+        uint64_t wcnt;
+        if (cr.read(wcnt)) {
+            cr.invalid(xsink);
+            return -1;
+        }
+        for (uint64_t i = 0; i < wcnt; ++i) {
+            SavedStats ss;
+            uint32_t cnt;
+            if (cr.read(ss.wfid) || cr.read(ss.sla) || cr.read(cnt)) {
+                cr.invalid(xsink);
+                return -1;
+            }
+            for (uint32_t j = 0; j < cnt; ++j) {
+                SavedSlot s;
+                uint8_t nb;
+                if (cr.read(s.minute) || cr.read(s.totals) || cr.read(nb)) {
+                    cr.invalid(xsink);
+                    return -1;
+                }
+                for (unsigned k = 0; k < nb; ++k) {
+                    uint8_t idx;
+                    uint32_t n;
+                    if (cr.read(idx) || cr.read(n) || idx >= OSA_BUCKETS) {
+                        cr.invalid(xsink);
+                        return -1;
+                    }
+                    s.buckets.push_back(std::make_pair(idx, n));
+                }
+                ss.slots.push_back(std::move(s));
+            }
+            wsl.push_back(std::move(ss));
+        }
+        if (!cr.atEnd()) {
+            cr.invalid(xsink);
+            return -1;
+        }
+
+        AutoLocker al(lck);
+        for (auto& ss : wsl) {
+            WorkflowStats& ws = getStats(ss.wfid, ss.sla);
+            for (auto& sd : ss.slots) {
+                if (sd.minute <= ws.cutoff[OSA_BANDS - 1]) {
+                    continue;
+                }
+                Slot* s = ws.getSlot(sd.minute);
+                if (!s) {
+                    continue;
+                }
+                for (auto& b : sd.buckets) {
+                    s->addSketch(b.first, b.second);
+                }
+                s->add(sd.totals);
+                ws.addDelta(sd.minute, sd.totals);
+            }
+        }
+        return cr.getSaved();
+    }
+
+    // returns memory usage info
+    DLLLOCAL QoreHashNode* getInfo() const {
+        int64 active = 0;
+        int64 chunks = 0;
+        int64 sketches = 0;
+        int64 size;
+        {
+            AutoLocker al(lck);
+            size = wsmap.size();
+            for (auto& i : wsmap) {
+                unsigned n = i.second.getChunkCount();
+                if (!n) {
+                    continue;
+                }
+                ++active;
+                chunks += n;
+                i.second.forEachSlot([&sketches] (const Slot& s) {
+                    if (s.sketch) {
+                        ++sketches;
+                    }
+                });
+            }
+        }
+
+        ReferenceHolder<QoreHashNode> rv(new QoreHashNode(autoTypeInfo), nullptr);
+        rv->setKeyValue("workflows", size, nullptr);
+        rv->setKeyValue("active", active, nullptr);
+        rv->setKeyValue("bytes", chunks * OSA_CHUNK_SLOTS * (int64)sizeof(Slot)
+            + sketches * OSA_BUCKETS * (int64)sizeof(uint32_t), nullptr);
+        return rv.release();
+    }
+
+protected:
+    // band totals
+    struct BandTotals {
+        // disposition counts
+        int64 disp[OSA_DISPOSITIONS] = {0, 0, 0};
+        // in SLA count
+        int64 in = 0;
+        // out of SLA count
+        int64 out = 0;
+
+        DLLLOCAL void add(const BandTotals& t, int64 mult) {
+            for (unsigned i = 0; i < OSA_DISPOSITIONS; ++i) {
+                disp[i] += t.disp[i] * mult;
+            }
+            in += t.in * mult;
+            out += t.out * mult;
+        }
+
+        DLLLOCAL bool empty() const {
+            for (unsigned i = 0; i < OSA_DISPOSITIONS; ++i) {
+                if (disp[i]) {
+                    return false;
+                }
+            }
+            return !in && !out;
+        }
+    };
+
+    // one minute of order events
+    struct Slot {
+        // the minute as minutes since the epoch; -1 = empty
+        int64 minute = -1;
+        // event totals for the minute
+        BandTotals totals;
+        // duration sketch for recalculating SLA counts; allocated with the first duration
+        std::unique_ptr<uint32_t[]> sketch;
+
+        DLLLOCAL void add(const BandTotals& t) {
+            totals.add(t, 1);
+        }
+
+        DLLLOCAL void addSketch(unsigned bucket, int64 count) {
+            assert(bucket < OSA_BUCKETS);
+            if (!sketch) {
+                sketch.reset(new uint32_t[OSA_BUCKETS]());
+            }
+            sketch[bucket] += (uint32_t)count;
+        }
+
+        DLLLOCAL void clear() {
+            minute = -1;
+            totals = BandTotals();
+            if (sketch) {
+                memset(sketch.get(), 0, sizeof(uint32_t) * OSA_BUCKETS);
+            }
+        }
+
+        // returns the number of durations in SLA for the given threshold
+        /** durations in the bucket containing the threshold are assumed to be evenly distributed
+        */
+        DLLLOCAL int64 getInSla(int64 sla) const {
+            if (!sketch) {
+                return 0;
+            }
+            int64 rv = 0;
+            // the last bucket is always out of SLA
+            for (unsigned i = 0; i < OSA_BUCKETS - 1; ++i) {
+                if (!sketch[i]) {
+                    continue;
+                }
+                double lo = getLowerBound(i);
+                double hi = getLowerBound(i + 1);
+                if (hi <= (double)sla) {
+                    rv += sketch[i];
+                } else if (lo <= (double)sla) {
+                    rv += (int64)(sketch[i] * ((double)sla - lo) / (hi - lo) + 0.5);
+                }
+            }
+            return rv;
+        }
+    };
+
+    // statistics for a workflow
+    struct WorkflowStats {
+        // per-minute ring buffer in chunks of one hour; chunks are allocated with the first event in the chunk
+        std::unique_ptr<Slot[]> ring[OSA_CHUNKS];
+        // current totals per band
+        BandTotals totals[OSA_BANDS];
+        // totals returned with the last call to getChanged()
+        BandTotals last[OSA_BANDS];
+        // slots with a minute less than or equal to the cutoff are not included in the band
+        int64 cutoff[OSA_BANDS];
+        // the SLA threshold for in / out of SLA counters
+        int64 sla;
+
+        DLLLOCAL WorkflowStats(int64 now, int64 sla) : sla(sla) {
+            for (unsigned i = 0; i < OSA_BANDS; ++i) {
+                cutoff[i] = getCutoff(i, now);
+            }
+        }
+
+        // adds the given totals to all bands covering the given minute
+        DLLLOCAL void addDelta(int64 minute, const BandTotals& delta, int64 mult = 1) {
+            for (unsigned i = 0; i < OSA_BANDS; ++i) {
+                if (minute > cutoff[i]) {
+                    totals[i].add(delta, mult);
+                }
+            }
+        }
+
+        DLLLOCAL void addSlot(const Slot& s, int64 mult) {
+            if (s.minute >= 0) {
+                addDelta(s.minute, s.totals, mult);
+            }
+        }
+
+        DLLLOCAL void advance(int64 now) {
+            for (unsigned i = 0; i < OSA_BANDS; ++i) {
+                int64 nc = getCutoff(i, now);
+                if (nc <= cutoff[i]) {
+                    continue;
+                }
+                if (!totals[i].empty()) {
+                    if (nc - cutoff[i] >= OSA_SLOTS) {
+                        forEachSlot([this, i, nc] (const Slot& s) {
+                            expire(i, s, nc);
+                        });
+                    } else {
+                        for (int64 m = cutoff[i] + 1; m <= nc; ++m) {
+                            if (const Slot* s = findSlot(m)) {
+                                expire(i, *s, nc);
+                            }
+                        }
+                    }
+                }
+                // chunks can only leave the largest band when it passes an hour boundary
+                if (i == OSA_BANDS - 1 && floorDiv(nc, OSA_CHUNK_SLOTS) != floorDiv(cutoff[i], OSA_CHUNK_SLOTS)) {
+                    releaseExpired(nc);
+                }
+                cutoff[i] = nc;
+            }
+        }
+
+        // returns the slot for the given minute, clearing old data if necessary, or nullptr if the minute is
+        // outside the ring
+        DLLLOCAL Slot* getSlot(int64 minute) {
+            std::unique_ptr<Slot[]>& chunk = ring[getChunk(minute)];
+            if (!chunk) {
+                chunk.reset(new Slot[OSA_CHUNK_SLOTS]);
+            }
+            Slot& s = chunk[minute % OSA_CHUNK_SLOTS];
+            if (s.minute != minute) {
+                // the slot holds newer data
+                if (s.minute > minute) {
+                    return nullptr;
+                }
+                // remove old data from any bands where it has not yet expired
+                addSlot(s, -1);
+                s.clear();
+                s.minute = minute;
+            }
+            return &s;
+        }
+
+        // calls the given function for each slot in the largest band
+        template <typename F>
+        DLLLOCAL void forEachSaved(F f) const {
+            int64 c = cutoff[OSA_BANDS - 1];
+            forEachSlot([c, &f] (const Slot& s) {
+                if (s.minute > c) {
+                    f(s);
+                }
+            });
+        }
+
+        // calls the given function for each slot in allocated chunks
+        template <typename F>
+        DLLLOCAL void forEachSlot(F f) const {
+            for (unsigned i = 0; i < OSA_CHUNKS; ++i) {
+                if (!ring[i]) {
+                    continue;
+                }
+                for (unsigned j = 0; j < OSA_CHUNK_SLOTS; ++j) {
+                    const Slot& s = ring[i][j];
+                    f(s);
+                }
+            }
+        }
+
+        // returns the number of allocated chunks
+        DLLLOCAL unsigned getChunkCount() const {
+            unsigned rv = 0;
+            for (unsigned i = 0; i < OSA_CHUNKS; ++i) {
+                if (ring[i]) {
+                    ++rv;
+                }
+            }
+            return rv;
+        }
+
+        // releases all chunks
+        DLLLOCAL void release() {
+            for (unsigned i = 0; i < OSA_CHUNKS; ++i) {
+                ring[i].reset();
+            }
+        }
+
+        DLLLOCAL void setSla(int64 n_sla) {
+            if (n_sla == sla) {
+                return;
+            }
+            sla = n_sla;
+            for (unsigned i = 0; i < OSA_CHUNKS; ++i) {
+                if (!ring[i]) {
+                    continue;
+                }
+                for (unsigned j = 0; j < OSA_CHUNK_SLOTS; ++j) {
+                    Slot& s = ring[i][j];
+                    if (s.minute < 0 || !s.sketch) {
+                        continue;
+                    }
+                    BandTotals delta;
+                    int64 total = s.totals.in + s.totals.out;
+                    delta.in = s.getInSla(sla) - s.totals.in;
+                    delta.out = (total - s.totals.in - delta.in) - s.totals.out;
+                    s.add(delta);
+                    addDelta(s.minute, delta);
+                }
+            }
+        }
+
+    private:
+        // returns the index of the chunk holding the slot for the given minute
+        DLLLOCAL static unsigned getChunk(int64 minute) {
+            return (unsigned)(minute % OSA_SLOTS) / OSA_CHUNK_SLOTS;
+        }
+
+        // returns the slot for the given minute if its chunk is allocated; the slot may hold another minute
+        DLLLOCAL const Slot* findSlot(int64 minute) const {
+            const std::unique_ptr<Slot[]>& chunk = ring[getChunk(minute)];
+            return chunk ? &chunk[minute % OSA_CHUNK_SLOTS] : nullptr;
+        }
+
+        // releases chunks where all slots are outside the largest band with the given cutoff
+        DLLLOCAL void releaseExpired(int64 nc) {
+            for (unsigned i = 0; i < OSA_CHUNKS; ++i) {
+                if (!ring[i]) {
+                    continue;
+                }
+                bool expired = true;
+                for (unsigned j = 0; j < OSA_CHUNK_SLOTS; ++j) {
+                    if (ring[i][j].minute > nc) {
+                        expired = false;
+                        break;
+                    }
+                }
+                if (expired) {
+                    ring[i].reset();
+                }
+            }
+        }
+
+        // removes the slot from the given band if it is in the band and is expired
+        DLLLOCAL void expire(unsigned band, const Slot& s, int64 nc) {
+            if (s.minute > cutoff[band] && s.minute <= nc) {
+                totals[band].add(s.totals, -1);
+            }
+        }
+    };
+
+    // map of workflow stats; wfid -> stats
+    typedef std::map<int64, WorkflowStats> wsmap_t;
+    wsmap_t wsmap;
+
+    // global totals returned with the last call to getChanged()
+    BandTotals global_last[OSA_BANDS];
+
+    // the time of the last update in seconds since the epoch
+    int64 now;
+
+    // mutex for data access
+    mutable QoreThreadLock lck;
+
+    // returns the band cutoff in minutes since the epoch for the given time
+    DLLLOCAL static int64 getCutoff(unsigned band, int64 now) {
+        return floorDiv(now - getBandHours(band) * 3600, 60);
+    }
+
+    // copies all data to the given checkpoint buffer; lck must be held
+    DLLLOCAL void copyCheckpoint(CheckpointBuffer& cb) const {
+        // workflow count, then for each workflow: wfid, SLA threshold, slot count, and slots
+        size_t data_size = sizeof(uint64_t);
+        for (auto& i : wsmap) {
+            data_size += sizeof(int64) * 2 + sizeof(uint32_t);
+            i.second.forEachSaved([&data_size] (const Slot& s) {
+                data_size += getSavedSize(s);
+            });
+        }
+        cb.resize(data_size);
+
+        cb.write((uint64_t)wsmap.size());
+        for (auto& i : wsmap) {
+            cb.write(i.first);
+            cb.write(i.second.sla);
+            uint32_t cnt = 0;
+            i.second.forEachSaved([&cnt] (const Slot& s) {
+                ++cnt;
+            });
+            cb.write(cnt);
+            i.second.forEachSaved([&cb] (const Slot& s) {
+                cb.write(s.minute);
+                cb.write(s.totals);
+                // the sketch is written as a bucket count followed by bucket index / count pairs
+                uint8_t nb = 0;
+                if (s.sketch) {
+                    for (unsigned j = 0; j < OSA_BUCKETS; ++j) {
+                        if (s.sketch[j]) {
+                            ++nb;
+                        }
+                    }
+                }
+                cb.write(nb);
+                for (unsigned j = 0; nb && j < OSA_BUCKETS; ++j) {
+                    if (s.sketch[j]) {
+                        cb.write((uint8_t)j);
+                        cb.write(s.sketch[j]);
+                    }
+                }
+            });
+        }
+    }
+
+    // returns the number of bytes needed to save the given slot
+    DLLLOCAL static size_t getSavedSize(const Slot& s) {
+        size_t rv = sizeof(int64) + sizeof(BandTotals) + sizeof(uint8_t);
+        if (s.sketch) {
+            for (unsigned i = 0; i < OSA_BUCKETS; ++i) {
+                if (s.sketch[i]) {
+                    rv += sizeof(uint8_t) + sizeof(uint32_t);
+                }
+            }
+        }
+        return rv;
+    }
+
+    DLLLOCAL static int64 floorDiv(int64 n, int64 d) {
+        int64 rv = n / d;
+        return (n % d && n < 0) ? rv - 1 : rv;
+    }
+
+    DLLLOCAL WorkflowStats& getStats(int64 wfid, int64 sla) {
+        wsmap_t::iterator i = wsmap.lower_bound(wfid);
+        if (i == wsmap.end() || i->first != wfid) {
+            return wsmap.insert(i, wsmap_t::value_type(wfid, WorkflowStats(now, sla)))->second;
+        }
+        i->second.setSla(sla);
+        return i->second;
+    }
+
+    DLLLOCAL void getGlobalTotals(BandTotals* totals) const {
+        for (auto& i : wsmap) {
+            for (unsigned j = 0; j < OSA_BANDS; ++j) {
+                totals[j].add(i.second.totals[j], 1);
+            }
+        }
+    }
+
+    // returns a hash of band -> {"event_summary_hash": {disposition -> count}, "slah": {"0"|"1" -> count}}
+    DLLLOCAL static QoreHashNode* makeSummary(const BandTotals* totals) {
+        static const char* dispositions[OSA_DISPOSITIONS] = {"C", "A", "M"};
+
+        ReferenceHolder<QoreHashNode> rv(new QoreHashNode(autoTypeInfo), nullptr);
+        for (unsigned i = 0; i < OSA_BANDS; ++i) {
+            ReferenceHolder<QoreHashNode> esh(new QoreHashNode(bigIntTypeInfo), nullptr);
+            for (unsigned j = 0; j < OSA_DISPOSITIONS; ++j) {
+                esh->setKeyValue(dispositions[j], totals[i].disp[j], nullptr);
+            }
+            ReferenceHolder<QoreHashNode> slah(new QoreHashNode(bigIntTypeInfo), nullptr);
+            slah->setKeyValue("0", totals[i].out, nullptr);
+            slah->setKeyValue("1", totals[i].in, nullptr);
+
+            QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+            h->setKeyValue("event_summary_hash", esh.release(), nullptr);
+            h->setKeyValue("slah", slah.release(), nullptr);
+
+            QoreStringMaker band_str(QLLD, getBandHours(i));
+            rv->setKeyValue(band_str.c_str(), h, nullptr);
+        }
+        return rv.release();
+    }
+};
+
+DLLLOCAL extern qore_classid_t CID_ORDERSTATSAGGREGATOR;
+DLLLOCAL QoreClass* initOrderStatsAggregatorClass(QoreNamespace& ns);
+
+#endif
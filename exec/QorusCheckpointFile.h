@@ -0,0 +1,265 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QorusCheckpointFile.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Memory-mapped checkpoint files for native in-memory state:
+    * files start with a header with a magic value, a format version, and the time the checkpoint was written
+    * data is written in host byte order; checkpoints are only read by the process that wrote them or its
+      successor on the same host
+    * files are written to a temporary file in the same directory and renamed into place when complete, so a
+      checkpoint is either complete or not present
+    * data protected by a lock can be copied to a CheckpointBuffer under the lock and written to disk after the lock
+      has been released
+*/
+
+#ifndef _QORUS_CHECKPOINT_FILE_H
+#define _QORUS_CHECKPOINT_FILE_H
+
+#include <qore/Qore.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+struct CheckpointHeader {
+    uint32_t magic;
+    uint32_t version;
+    // time the checkpoint was written as seconds since the epoch
+    int64 saved;
+};
+
+// writes a checkpoint file of a known size through a shared memory mapping
+class CheckpointWriter {
+public:
+    // creates the temporary file and maps it; errors are raised in xsink
+    DLLLOCAL CheckpointWriter(const char* path, uint32_t magic, uint32_t version, int64 saved, size_t data_size,
+            const char* err, ExceptionSink* xsink) : path(path), tmp_path(path), err(err) {
+        tmp_path += ".tmp";
+        size = sizeof(CheckpointHeader) + data_size;
+
+        fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            xsink->raiseErrnoException(err, errno, "cannot create checkpoint file '%s'", tmp_path.c_str());
+            return;
+        }
+        if (ftruncate(fd, size)) {
+            xsink->raiseErrnoException(err, errno, "cannot set size of checkpoint file '%s' to %lu bytes",
+                tmp_path.c_str(), (unsigned long)size);
+            return;
+        }
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            xsink->raiseErrnoException(err, errno, "cannot map checkpoint file '%s'", tmp_path.c_str());
+            return;
+        }
+        data = (char*)p;
+
+        CheckpointHeader hdr = {magic, version, saved};
+        write(hdr);
+    }
+
+    // discards the temporary file if the checkpoint was not committed
+    DLLLOCAL ~CheckpointWriter() {
+        if (data) {
+            munmap(data, size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            unlink(tmp_path.c_str());
+        }
+    }
+
+    DLLLOCAL operator bool() const {
+        return data;
+    }
+
+    template <typename T>
+    DLLLOCAL void write(const T& v) {
+        write(&v, sizeof(T));
+    }
+
+    DLLLOCAL void write(const void* buf, size_t len) {
+        assert(data);
+        assert(pos + len <= size);
+        memcpy(data + pos, buf, len);
+        pos += len;
+    }
+
+    // flushes the checkpoint to disk and renames it into place
+    DLLLOCAL int commit(ExceptionSink* xsink) {
+        assert(data);
+        assert(pos == size);
+        int rc = msync(data, size, MS_SYNC);
+        munmap(data, size);
+        data = nullptr;
+        if (rc) {
+            xsink->raiseErrnoException(err, errno, "cannot write checkpoint file '%s'", tmp_path.c_str());
+            return -1;
+        }
+        ::close(fd);
+        fd = -1;
+        if (rename(tmp_path.c_str(), path.c_str())) {
+            xsink->raiseErrnoException(err, errno, "cannot rename checkpoint file '%s' to '%s'", tmp_path.c_str(),
+                path.c_str());
+            unlink(tmp_path.c_str());
+            return -1;
+        }
+        return 0;
+    }
+
+private:
+    std::string path;
+    std::string tmp_path;
+    const char* err;
+    int fd = -1;
+    char* data = nullptr;
+    size_t size;
+    size_t pos = 0;
+};
+
+// collects checkpoint data in memory so that it can be written to disk without holding the lock protecting it
+class CheckpointBuffer {
+public:
+    DLLLOCAL CheckpointBuffer(uint32_t magic, uint32_t version, int64 saved) : magic(magic), version(version),
+            saved(saved) {
+    }
+
+    // sets the size of the checkpoint data, not including the header
+    DLLLOCAL void resize(size_t data_size) {
+        buf.resize(data_size);
+        pos = 0;
+    }
+
+    template <typename T>
+    DLLLOCAL void write(const T& v) {
+        write(&v, sizeof(T));
+    }
+
+    DLLLOCAL void write(const void* src, size_t len) {
+        assert(pos + len <= buf.size());
+        memcpy(buf.data() + pos, src, len);
+        pos += len;
+    }
+
+    // writes the checkpoint file, flushes it to disk, and renames it into place; errors are raised in xsink
+    DLLLOCAL int save(const char* path, const char* err, ExceptionSink* xsink) const {
+        assert(pos == buf.size());
+        CheckpointWriter cw(path, magic, version, saved, buf.size(), err, xsink);
+        if (!cw) {
+            return -1;
+        }
+        cw.write(buf.data(), buf.size());
+        return cw.commit(xsink);
+    }
+
+private:
+    uint32_t magic;
+    uint32_t version;
+    int64 saved;
+    std::vector<char> buf;
+    size_t pos = 0;
+};
+
+// reads a checkpoint file through a private read-only memory mapping
+class CheckpointReader {
+public:
+    // maps the file and verifies the header; errors are raised in xsink
+    DLLLOCAL CheckpointReader(const char* path, uint32_t magic, uint32_t version, const char* err,
+            ExceptionSink* xsink) : path(path), err(err) {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            xsink->raiseErrnoException(err, errno, "cannot open checkpoint file '%s'", path);
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st)) {
+            xsink->raiseErrnoException(err, errno, "cannot stat checkpoint file '%s'", path);
+            ::close(fd);
+            return;
+        }
+        size = st.st_size;
+        if (size < sizeof(CheckpointHeader)) {
+            ::close(fd);
+            invalid(xsink);
+            return;
+        }
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            xsink->raiseErrnoException(err, errno, "cannot map checkpoint file '%s'", path);
+            return;
+        }
+        data = (const char*)p;
+
+        read(hdr);
+        if (hdr.magic != magic || hdr.version != version) {
+            invalid(xsink);
+        }
+    }
+
+    DLLLOCAL ~CheckpointReader() {
+        if (data) {
+            munmap((void*)data, size);
+        }
+    }
+
+    // returns the time the checkpoint was written
+    DLLLOCAL int64 getSaved() const {
+        return hdr.saved;
+    }
+
+    // reads the given value; returns -1 if the file is truncated
+    template <typename T>
+    DLLLOCAL int read(T& v) {
+        return read(&v, sizeof(T));
+    }
+
+    DLLLOCAL int read(void* buf, size_t len) {
+        if (!data || (size - pos) < len) {
+            return -1;
+        }
+        memcpy(buf, data + pos, len);
+        pos += len;
+        return 0;
+    }
+
+    // returns true if all data has been read
+    DLLLOCAL bool atEnd() const {
+        return pos == size;
+    }
+
+    // raises an exception for an invalid or truncated file
+    DLLLOCAL void invalid(ExceptionSink* xsink) const {
+        xsink->raiseException(err, "checkpoint file '%s' is invalid or truncated", path);
+    }
+
+private:
+    const char* path;
+    const char* err;
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    CheckpointHeader hdr = {0, 0, 0};
+};
+
+#endif
@@ -0,0 +1,754 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QorusClusterCodec.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Native codec for cluster messages:
+    * messages start with the magic bytes "QX" and a version byte; anything else is passed to the fallback decoder
+      unchanged, so data serialized with Serializable::serialize() can still be decoded
+    * plain data (nothing, NULL, bool, int, float, number, string, binary, dates in the local time zone, untyped
+      lists and hashes, and lists and hashes with scalar, hash<auto>, or list<auto> elements) is encoded in a single
+      pass directly into the buffer of the resulting binary value without building an intermediate representation
+    * integers and lengths are encoded as variable-length integers, so small values take a single byte
+    * lists of at least two hashes with the same keys in the same order (ex: SQL row lists) are encoded with the keys
+      stored only once
+    * any other value (objects, typed hashes, dates in other time zones, ...) is passed to the fallback encoder
+      (normally Serializable::serialize()) and embedded in the message; the fallback decoder (normally
+      Serializable::deserialize()) is called for the embedded value when the message is decoded, so such values are
+      deserialized in the context of the caller
+*/
+
+#ifndef _QORUS_CLUSTER_CODEC_H
+#define _QORUS_CLUSTER_CODEC_H
+
+#include <qore/Qore.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#define QORUS_CLUSTER_CODEC_MAGIC "QX"
+#define QORUS_CLUSTER_CODEC_VERSION 1
+#define QORUS_CLUSTER_CODEC_ERR "CLUSTER-CODEC-ERROR"
+
+// value tags
+enum qorus_cluster_codec_tag_e : unsigned char {
+    QCC_NOTHING = 0,
+    QCC_NULL = 1,
+    QCC_TRUE = 2,
+    QCC_FALSE = 3,
+    QCC_INT = 4,            // zigzag varint
+    QCC_FLOAT = 5,          // 8 bytes, little endian
+    QCC_NUMBER = 6,         // varint precision, varint length, string
+    QCC_STRING = 7,         // varint length, UTF-8 string
+    QCC_STRING_ENC = 8,     // varint length, encoding name, varint length, string
+    QCC_BINARY = 9,         // varint length, data
+    QCC_DATE = 10,          // zigzag varint epoch seconds, varint microseconds; local time zone
+    QCC_RDATE = 11,         // 7 zigzag varints: years, months, days, hours, minutes, seconds, microseconds
+    QCC_LIST = 12,          // element type, varint count, values
+    QCC_HASH = 13,          // element type, varint count, (varint length, key, value) pairs
+    QCC_ROWS = 14,          // list element type, varint key count, (varint length, key) keys, varint row count,
+                            // row values
+    QCC_SERIALIZED = 15,    // varint length, data from the fallback encoder
+};
+
+// element types of typed lists and hashes
+enum qorus_cluster_codec_type_e : unsigned char {
+    QCC_T_AUTO = 0,
+    QCC_T_STRING = 1,
+    QCC_T_INT = 2,
+    QCC_T_FLOAT = 3,
+    QCC_T_NUMBER = 4,
+    QCC_T_BOOL = 5,
+    QCC_T_DATE = 6,
+    QCC_T_BINARY = 7,
+    QCC_T_HASH = 8,
+    QCC_T_LIST = 9,
+    // the type cannot be encoded; the value is passed to the fallback encoder
+    QCC_T_NONE = 0xff,
+};
+
+class QorusClusterCodec {
+public:
+    // returns true if the data was encoded with this codec
+    DLLLOCAL static bool isEncoded(const void* p, size_t len) {
+        return len >= 3 && !memcmp(p, QORUS_CLUSTER_CODEC_MAGIC, 2);
+    }
+
+protected:
+    DLLLOCAL static unsigned char getTypeCode(const QoreTypeInfo* ti) {
+        if (!ti || ti == autoTypeInfo) {
+            return QCC_T_AUTO;
+        }
+        if (ti == stringTypeInfo) {
+            return QCC_T_STRING;
+        }
+        if (ti == bigIntTypeInfo) {
+            return QCC_T_INT;
+        }
+        if (ti == floatTypeInfo) {
+            return QCC_T_FLOAT;
+        }
+        if (ti == numberTypeInfo) {
+            return QCC_T_NUMBER;
+        }
+        if (ti == boolTypeInfo) {
+            return QCC_T_BOOL;
+        }
+        if (ti == dateTypeInfo) {
+            return QCC_T_DATE;
+        }
+        if (ti == binaryTypeInfo) {
+            return QCC_T_BINARY;
+        }
+        if (ti == autoHashTypeInfo) {
+            return QCC_T_HASH;
+        }
+        if (ti == autoListTypeInfo) {
+            return QCC_T_LIST;
+        }
+        return QCC_T_NONE;
+    }
+
+    DLLLOCAL static const QoreTypeInfo* getTypeInfo(unsigned char code) {
+        switch (code) {
+            case QCC_T_AUTO: return autoTypeInfo;
+            case QCC_T_STRING: return stringTypeInfo;
+            case QCC_T_INT: return bigIntTypeInfo;
+            case QCC_T_FLOAT: return floatTypeInfo;
+            case QCC_T_NUMBER: return numberTypeInfo;
+            case QCC_T_BOOL: return boolTypeInfo;
+            case QCC_T_DATE: return dateTypeInfo;
+            case QCC_T_BINARY: return binaryTypeInfo;
+            case QCC_T_HASH: return autoHashTypeInfo;
+            case QCC_T_LIST: return autoListTypeInfo;
+        }
+        return nullptr;
+    }
+};
+
+class QorusClusterEncoder : public QorusClusterCodec {
+public:
+    DLLLOCAL QorusClusterEncoder(const ResolvedCallReferenceNode* fallback, ExceptionSink* xsink)
+            : fallback(fallback), xsink(xsink) {
+    }
+
+    DLLLOCAL ~QorusClusterEncoder() {
+        free(buf);
+    }
+
+    // returns the encoded value or nullptr if an exception was raised
+    DLLLOCAL BinaryNode* encode(QoreValue v) {
+        putBytes(QORUS_CLUSTER_CODEC_MAGIC, 2);
+        put(QORUS_CLUSTER_CODEC_VERSION);
+        if (encodeValue(v)) {
+            return nullptr;
+        }
+        // the binary value takes ownership of the buffer
+        BinaryNode* rv = new BinaryNode(buf, len);
+        buf = nullptr;
+        return rv;
+    }
+
+private:
+    const ResolvedCallReferenceNode* fallback;
+    ExceptionSink* xsink;
+    char* buf = nullptr;
+    size_t len = 0;
+    size_t cap = 0;
+
+    DLLLOCAL void reserve(size_t size) {
+        if (len + size <= cap) {
+            return;
+        }
+        size_t ncap = cap ? cap * 2 : 256;
+        while (ncap < len + size) {
+            ncap *= 2;
+        }
+        char* nbuf = (char*)realloc(buf, ncap);
+        if (!nbuf) {
+            throw std::bad_alloc();
+        }
+        buf = nbuf;
+        cap = ncap;
+    }
+
+    DLLLOCAL void put(unsigned char c) {
+        reserve(1);
+        buf[len++] = c;
+    }
+
+    DLLLOCAL void putBytes(const void* p, size_t size) {
+        reserve(size);
+        memcpy(buf + len, p, size);
+        len += size;
+    }
+
+    DLLLOCAL void putVarint(uint64_t i) {
+        reserve(10);
+        while (i >= 0x80) {
+            buf[len++] = (char)(i | 0x80);
+            i >>= 7;
+        }
+        buf[len++] = (char)i;
+    }
+
+    DLLLOCAL void putInt(int64 i) {
+        putVarint(((uint64_t)i << 1) ^ (uint64_t)(i >> 63));
+    }
+
+    DLLLOCAL void putString(const char* str, size_t size) {
+        putVarint(size);
+        putBytes(str, size);
+    }
+
+    // encodes a value with the fallback encoder
+    DLLLOCAL int encodeFallback(QoreValue v) {
+        ReferenceHolder<QoreListNode> args(new QoreListNode(autoTypeInfo), xsink);
+        args->push(v.refSelf(), xsink);
+        ValueHolder rv(fallback->execValue(*args, xsink), xsink);
+        if (*xsink) {
+            return -1;
+        }
+        if (rv->getType() != NT_BINARY) {
+            xsink->raiseException(QORUS_CLUSTER_CODEC_ERR, "the fallback encoder returned type \"%s\"; expecting "
+                "\"binary\"", rv->getFullTypeName());
+            return -1;
+        }
+        const BinaryNode* b = rv->get<const BinaryNode>();
+        put(QCC_SERIALIZED);
+        putString((const char*)b->getPtr(), b->size());
+        return 0;
+    }
+
+    DLLLOCAL int encodeValue(QoreValue v) {
+        switch (v.getType()) {
+            case NT_NOTHING:
+                put(QCC_NOTHING);
+                return 0;
+
+            case NT_NULL:
+                put(QCC_NULL);
+                return 0;
+
+            case NT_BOOLEAN:
+                put(v.getAsBool() ? QCC_TRUE : QCC_FALSE);
+                return 0;
+
+            case NT_INT:
+                put(QCC_INT);
+                putInt(v.getAsBigInt());
+                return 0;
+
+            case NT_FLOAT: {
+                double f = v.getAsFloat();
+                uint64_t u;
+                memcpy(&u, &f, sizeof u);
+                put(QCC_FLOAT);
+                reserve(8);
+                for (int i = 0; i < 8; ++i) {
+                    buf[len++] = (char)(u >> (i * 8));
+                }
+                return 0;
+            }
+
+            case NT_NUMBER: {
+                const QoreNumberNode* n = v.get<const QoreNumberNode>();
+                QoreString str;
+                n->toString(str);
+                put(QCC_NUMBER);
+                putVarint(n->getPrec());
+                putString(str.c_str(), str.size());
+                return 0;
+            }
+
+            case NT_STRING: {
+                const QoreStringNode* str = v.get<const QoreStringNode>();
+                if (str->getEncoding() == QCS_UTF8) {
+                    put(QCC_STRING);
+                } else {
+                    put(QCC_STRING_ENC);
+                    const char* enc = str->getEncoding()->getCode();
+                    putString(enc, strlen(enc));
+                }
+                putString(str->c_str(), str->size());
+                return 0;
+            }
+
+            case NT_BINARY: {
+                const BinaryNode* b = v.get<const BinaryNode>();
+                put(QCC_BINARY);
+                putString((const char*)b->getPtr(), b->size());
+                return 0;
+            }
+
+            case NT_DATE: {
+                const DateTimeNode* d = v.get<const DateTimeNode>();
+                if (d->isRelative()) {
+                    put(QCC_RDATE);
+                    putInt(d->getYear());
+                    putInt(d->getMonth());
+                    putInt(d->getDay());
+                    putInt(d->getHour());
+                    putInt(d->getMinute());
+                    putInt(d->getSecond());
+                    putInt(d->getMicrosecond());
+                    return 0;
+                }
+                // dates in other time zones keep their time zone through the fallback encoder
+                if (d->getZone() != currentTZ()) {
+                    break;
+                }
+                put(QCC_DATE);
+                putInt(d->getEpochSecondsUTC());
+                putVarint(d->getMicrosecond());
+                return 0;
+            }
+
+            case NT_LIST: {
+                const QoreListNode* l = v.get<const QoreListNode>();
+                unsigned char type = getTypeCode(l->getValueTypeInfo());
+                if (type == QCC_T_NONE) {
+                    break;
+                }
+                if ((type == QCC_T_AUTO || type == QCC_T_HASH) && isRowList(l)) {
+                    return encodeRows(l, type);
+                }
+                put(QCC_LIST);
+                put(type);
+                putVarint(l->size());
+                ConstListIterator i(l);
+                while (i.next()) {
+                    if (encodeValue(i.getValue())) {
+                        return -1;
+                    }
+                }
+                return 0;
+            }
+
+            case NT_HASH: {
+                const QoreHashNode* h = v.get<const QoreHashNode>();
+                if (h->getHashDecl()) {
+                    break;
+                }
+                unsigned char type = getTypeCode(h->getValueTypeInfo());
+                if (type == QCC_T_NONE) {
+                    break;
+                }
+                put(QCC_HASH);
+                put(type);
+                putVarint(h->size());
+                ConstHashIterator i(h);
+                while (i.next()) {
+                    const char* key = i.getKey();
+                    putString(key, strlen(key));
+                    if (encodeValue(i.get())) {
+                        return -1;
+                    }
+                }
+                return 0;
+            }
+
+            default:
+                break;
+        }
+        return encodeFallback(v);
+    }
+
+    // returns true if the hash can be encoded as a row of a row list
+    DLLLOCAL static bool isPlainHash(QoreValue v) {
+        if (v.getType() != NT_HASH) {
+            return false;
+        }
+        const QoreHashNode* h = v.get<const QoreHashNode>();
+        return !h->getHashDecl() && getTypeCode(h->getValueTypeInfo()) == QCC_T_AUTO;
+    }
+
+    // returns true if the list has at least two hashes with the same keys in the same order and nothing else
+    DLLLOCAL static bool isRowList(const QoreListNode* l) {
+        if (l->size() < 2) {
+            return false;
+        }
+        ConstListIterator i(l);
+        i.next();
+        if (!isPlainHash(i.getValue())) {
+            return false;
+        }
+        const QoreHashNode* first = i.getValue().get<const QoreHashNode>();
+        if (!first->size()) {
+            return false;
+        }
+        while (i.next()) {
+            if (!isPlainHash(i.getValue())) {
+                return false;
+            }
+            const QoreHashNode* h = i.getValue().get<const QoreHashNode>();
+            if (h->size() != first->size()) {
+                return false;
+            }
+            ConstHashIterator fi(first);
+            ConstHashIterator hi(h);
+            while (fi.next()) {
+                hi.next();
+                if (strcmp(fi.getKey(), hi.getKey())) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    DLLLOCAL int encodeRows(const QoreListNode* l, unsigned char type) {
+        put(QCC_ROWS);
+        put(type);
+        ConstListIterator i(l);
+        i.next();
+        const QoreHashNode* first = i.getValue().get<const QoreHashNode>();
+        putVarint(first->size());
+        {
+            ConstHashIterator hi(first);
+            while (hi.next()) {
+                const char* key = hi.getKey();
+                putString(key, strlen(key));
+            }
+        }
+        putVarint(l->size());
+        do {
+            ConstHashIterator hi(i.getValue().get<const QoreHashNode>());
+            while (hi.next()) {
+                if (encodeValue(hi.get())) {
+                    return -1;
+                }
+            }
+        } while (i.next());
+        return 0;
+    }
+};
+
+class QorusClusterDecoder : public QorusClusterCodec {
+public:
+    DLLLOCAL QorusClusterDecoder(const void* p, size_t size, const ResolvedCallReferenceNode* fallback,
+            ExceptionSink* xsink) : p((const unsigned char*)p), end((const unsigned char*)p + size),
+            fallback(fallback), xsink(xsink) {
+    }
+
+    // decodes an encoded message; returns QoreValue() if an exception was raised
+    DLLLOCAL QoreValue decode() {
+        assert(isEncoded(p, end - p));
+        p += 2;
+        unsigned char version = *p++;
+        if (version != QORUS_CLUSTER_CODEC_VERSION) {
+            xsink->raiseException(QORUS_CLUSTER_CODEC_ERR, "cannot decode message with codec version %d; expecting "
+                "version %d", (int)version, QORUS_CLUSTER_CODEC_VERSION);
+            return QoreValue();
+        }
+        ValueHolder rv(decodeValue(), xsink);
+        if (*xsink) {
+            return QoreValue();
+        }
+        if (p != end) {
+            xsink->raiseException(QORUS_CLUSTER_CODEC_ERR, "%lld extra byte(s) after the encoded value",
+                (long long)(end - p));
+            return QoreValue();
+        }
+        return rv.release();
+    }
+
+private:
+    const unsigned char* p;
+    const unsigned char* end;
+    const ResolvedCallReferenceNode* fallback;
+    ExceptionSink* xsink;
+
+    DLLLOCAL int truncated() {
+        xsink->raiseException(QORUS_CLUSTER_CODEC_ERR, "the encoded message is truncated or corrupt");
+        return -1;
+    }
+
+    DLLLOCAL int get(unsigned char& c) {
+        if (p == end) {
+            return truncated();
+        }
+        c = *p++;
+        return 0;
+    }
+
+    DLLLOCAL int getVarint(uint64_t& i) {
+        i = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (p == end) {
+                return truncated();
+            }
+            unsigned char c = *p++;
+            i |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) {
+                return 0;
+            }
+        }
+        return truncated();
+    }
+
+    DLLLOCAL int getInt(int64& i) {
+        uint64_t u;
+        if (getVarint(u)) {
+            return -1;
+        }
+        i = (int64)(u >> 1) ^ -(int64)(u & 1);
+        return 0;
+    }
+
+    // gets a length followed by the given number of bytes
+    DLLLOCAL int getString(const char*& str, size_t& size) {
+        uint64_t u;
+        if (getVarint(u)) {
+            return -1;
+        }
+        if (u > (uint64_t)(end - p)) {
+            return truncated();
+        }
+        str = (const char*)p;
+        size = u;
+        p += u;
+        return 0;
+    }
+
+    // gets a container element count; each element takes at least one byte
+    DLLLOCAL int getCount(size_t& count) {
+        uint64_t u;
+        if (getVarint(u)) {
+            return -1;
+        }
+        if (u > (uint64_t)(end - p)) {
+            return truncated();
+        }
+        count = u;
+        return 0;
+    }
+
+    DLLLOCAL int getType(const QoreTypeInfo*& ti) {
+        unsigned char c;
+        if (get(c)) {
+            return -1;
+        }
+        ti = getTypeInfo(c);
+        if (!ti) {
+            xsink->raiseException(QORUS_CLUSTER_CODEC_ERR, "unknown element type code %d", (int)c);
+            return -1;
+        }
+        return 0;
+    }
+
+    DLLLOCAL QoreValue decodeValue() {
+        unsigned char tag;
+        if (get(tag)) {
+            return QoreValue();
+        }
+        switch (tag) {
+            case QCC_NOTHING:
+                return QoreValue();
+
+            case QCC_NULL:
+                return QoreValue(&Null);
+
+            case QCC_TRUE:
+                return true;
+
+            case QCC_FALSE:
+                return false;
+
+            case QCC_INT: {
+                int64 i;
+                if (getInt(i)) {
+                    return QoreValue();
+                }
+                return i;
+            }
+
+            case QCC_FLOAT: {
+                if (end - p < 8) {
+                    truncated();
+                    return QoreValue();
+                }
+                uint64_t u = 0;
+                for (int i = 0; i < 8; ++i) {
+                    u |= (uint64_t)*p++ << (i * 8);
+                }
+                double f;
+                memcpy(&f, &u, sizeof f);
+                return f;
+            }
+
+            case QCC_NUMBER: {
+                uint64_t prec;
+                const char* str;
+                size_t size;
+                if (getVarint(prec) || getString(str, size)) {
+                    return QoreValue();
+                }
+                std::string num(str, size);
+                return new QoreNumberNode(num.c_str(), (unsigned)prec);
+            }
+
+            case QCC_STRING: {
+                const char* str;
+                size_t size;
+                if (getString(str, size)) {
+                    return QoreValue();
+                }
+                return new QoreStringNode(str, size, QCS_UTF8);
+            }
+
+            case QCC_STRING_ENC: {
+                const char* enc;
+                size_t enc_size;
+                const char* str;
+                size_t size;
+                if (getString(enc, enc_size) || getString(str, size)) {
+                    return QoreValue();
+                }
+                std::string enc_name(enc, enc_size);
+                return new QoreStringNode(str, size, QEM.findCreate(enc_name.c_str()));
+            }
+
+            case QCC_BINARY: {
+                const char* data;
+                size_t size;
+                if (getString(data, size)) {
+                    return QoreValue();
+                }
+                BinaryNode* b = new BinaryNode;
+                b->append(data, size);
+                return b;
+            }
+
+            case QCC_DATE: {
+                int64 secs;
+                uint64_t us;
+                if (getInt(secs) || getVarint(us)) {
+                    return QoreValue();
+                }
+                return DateTimeNode::makeAbsolute(currentTZ(), secs, (int)us);
+            }
+
+            case QCC_RDATE: {
+                int64 f[7];
+                for (int i = 0; i < 7; ++i) {
+                    if (getInt(f[i])) {
+                        return QoreValue();
+                    }
+                }
+                return DateTimeNode::makeRelative((int)f[0], (int)f[1], (int)f[2], (int)f[3], (int)f[4], (int)f[5],
+                    (int)f[6]);
+            }
+
+            case QCC_LIST: {
+                const QoreTypeInfo* ti;
+                size_t count;
+                if (getType(ti) || getCount(count)) {
+                    return QoreValue();
+                }
+                ReferenceHolder<QoreListNode> l(new QoreListNode(ti), xsink);
+                for (size_t i = 0; i < count; ++i) {
+                    QoreValue v = decodeValue();
+                    if (*xsink) {
+                        return QoreValue();
+                    }
+                    l->push(v, xsink);
+                }
+                return l.release();
+            }
+
+            case QCC_HASH: {
+                const QoreTypeInfo* ti;
+                size_t count;
+                if (getType(ti) || getCount(count)) {
+                    return QoreValue();
+                }
+                ReferenceHolder<QoreHashNode> h(new QoreHashNode(ti), xsink);
+                std::string key;
+                for (size_t i = 0; i < count; ++i) {
+                    const char* k;
+                    size_t size;
+                    if (getString(k, size)) {
+                        return QoreValue();
+                    }
+                    key.assign(k, size);
+                    QoreValue v = decodeValue();
+                    if (*xsink) {
+                        return QoreValue();
+                    }
+                    h->setKeyValue(key.c_str(), v, xsink);
+                }
+                return h.release();
+            }
+
+            case QCC_ROWS: {
+                const QoreTypeInfo* ti;
+                size_t nkeys;
+                if (getType(ti) || getCount(nkeys)) {
+                    return QoreValue();
+                }
+                std::vector<std::string> keys;
+                keys.reserve(nkeys);
+                for (size_t i = 0; i < nkeys; ++i) {
+                    const char* k;
+                    size_t size;
+                    if (getString(k, size)) {
+                        return QoreValue();
+                    }
+                    keys.push_back(std::string(k, size));
+                }
+                size_t nrows;
+                if (getCount(nrows)) {
+                    return QoreValue();
+                }
+                ReferenceHolder<QoreListNode> l(new QoreListNode(ti), xsink);
+                for (size_t i = 0; i < nrows; ++i) {
+                    ReferenceHolder<QoreHashNode> h(new QoreHashNode(autoTypeInfo), xsink);
+                    for (auto& k : keys) {
+                        QoreValue v = decodeValue();
+                        if (*xsink) {
+                            return QoreValue();
+                        }
+                        h->setKeyValue(k.c_str(), v, xsink);
+                    }
+                    l->push(h.release(), xsink);
+                }
+                return l.release();
+            }
+
+            case QCC_SERIALIZED: {
+                const char* data;
+                size_t size;
+                if (getString(data, size)) {
+                    return QoreValue();
+                }
+                BinaryNode* b = new BinaryNode;
+                b->append(data, size);
+                ReferenceHolder<QoreListNode> args(new QoreListNode(autoTypeInfo), xsink);
+                args->push(b, xsink);
+                ValueHolder rv(fallback->execValue(*args, xsink), xsink);
+                return *xsink ? QoreValue() : rv.release();
+            }
+        }
+
+        xsink->raiseException(QORUS_CLUSTER_CODEC_ERR, "unknown value tag %d", (int)tag);
+        return QoreValue();
+    }
+};
+
+#endif
@@ -0,0 +1,216 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QorusClusterCompression.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Compression of cluster messages:
+    * messages encoded with the native cluster codec are compressed with zlib with qorus_cluster_compress() only when
+      they are sent over a connection to a process on another node; messages to processes on the same node are
+      exchanged over IPC or in-process sockets, where compression would only add latency
+    * messages are compressed if they are at least the minimum size; smaller messages and messages that would not
+      shrink by at least 1/8 are sent uncompressed
+    * messages smaller than the bulk size are compressed with the fastest level to keep latency low; larger messages
+      are compressed with the default level for a better ratio
+    * compressed messages start with the codec magic bytes and the codec version with the high bit set, followed by
+      the size of the uncompressed message as a varint and the zlib stream of the uncompressed message; they are
+      decompressed transparently before decoding
+    * the minimum size is set with $QORUS_CLUSTER_COMPRESS_MIN (0 disables compression) and the bulk size with
+      $QORUS_CLUSTER_COMPRESS_BULK; invalid values are logged to standard error and the default is used
+    * counters for the number of bytes saved and the time spent compressing and decompressing messages are kept for
+      the lifetime of the process
+*/
+
+#ifndef _QORUS_CLUSTER_COMPRESSION_H
+#define _QORUS_CLUSTER_COMPRESSION_H
+
+#include <qore/Qore.h>
+
+#include "QorusClusterCodec.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <atomic>
+#include <string>
+
+// flag set in the codec version byte of compressed messages
+#define QORUS_CLUSTER_CODEC_COMPRESSED 0x80
+
+// default minimum size of a message to compress
+#define QORUS_CLUSTER_COMPRESS_MIN (32 * 1024)
+// default minimum size of a message to compress with the default compression level
+#define QORUS_CLUSTER_COMPRESS_BULK (1024 * 1024)
+
+class QorusClusterCompression {
+public:
+    DLLLOCAL QorusClusterCompression()
+            : min_size(getSize("QORUS_CLUSTER_COMPRESS_MIN", QORUS_CLUSTER_COMPRESS_MIN)),
+            bulk_size(getSize("QORUS_CLUSTER_COMPRESS_BULK", QORUS_CLUSTER_COMPRESS_BULK)) {
+    }
+
+    // returns true if the data is a compressed cluster message
+    DLLLOCAL static bool isCompressed(const void* p, size_t len) {
+        return QorusClusterCodec::isEncoded(p, len)
+            && (((const unsigned char*)p)[2] & QORUS_CLUSTER_CODEC_COMPRESSED);
+    }
+
+    // returns the compressed message if the message should be compressed, otherwise returns the message
+    /** takes ownership of the message
+    */
+    DLLLOCAL BinaryNode* compress(BinaryNode* b) {
+        size_t len = b->size();
+        if (!min_size || len < min_size) {
+            return b;
+        }
+
+        int64 start = now();
+        uLongf clen = compressBound(len);
+        // magic, version, and the uncompressed size as a varint
+        char* buf = (char*)malloc(3 + 10 + clen);
+        if (!buf) {
+            return b;
+        }
+        memcpy(buf, QORUS_CLUSTER_CODEC_MAGIC, 2);
+        buf[2] = (char)(QORUS_CLUSTER_CODEC_VERSION | QORUS_CLUSTER_CODEC_COMPRESSED);
+        size_t hlen = 3;
+        for (uint64_t i = len; ; i >>= 7) {
+            if (i < 0x80) {
+                buf[hlen++] = (char)i;
+                break;
+            }
+            buf[hlen++] = (char)(i | 0x80);
+        }
+
+        int level = len >= bulk_size ? Z_DEFAULT_COMPRESSION : Z_BEST_SPEED;
+        int rc = compress2((Bytef*)buf + hlen, &clen, (const Bytef*)b->getPtr(), len, level);
+        compress_us += now() - start;
+        if (rc != Z_OK || (hlen + clen) > (len - len / 8)) {
+            free(buf);
+            ++skipped;
+            return b;
+        }
+
+        ++compressed;
+        bytes_in += len;
+        bytes_out += hlen + clen;
+        b->deref();
+        // release the unused part of the buffer
+        char* nbuf = (char*)realloc(buf, hlen + clen);
+        return new BinaryNode(nbuf ? nbuf : buf, hlen + clen);
+    }
+
+    // decompresses a compressed message; returns -1 if an exception was raised
+    DLLLOCAL int decompress(const void* p, size_t len, std::string& out, ExceptionSink* xsink) {
+        assert(isCompressed(p, len));
+        const unsigned char* c = (const unsigned char*)p + 3;
+        const unsigned char* end = (const unsigned char*)p + len;
+        uint64_t size = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            if (c == end || shift >= 64) {
+                return corrupt(xsink);
+            }
+            unsigned char i = *c++;
+            size |= (uint64_t)(i & 0x7f) << shift;
+            if (!(i & 0x80)) {
+                break;
+            }
+        }
+        // zlib cannot compress data by more than a factor of about 1000
+        if (size > (uint64_t)(end - c) * 1032 + 1024) {
+            return corrupt(xsink);
+        }
+
+        int64 start = now();
+        out.resize(size);
+        uLongf ulen = size;
+        int rc = uncompress((Bytef*)&out[0], &ulen, c, end - c);
+        decompress_us += now() - start;
+        if (rc != Z_OK || ulen != size || !QorusClusterCodec::isEncoded(out.data(), out.size())) {
+            return corrupt(xsink);
+        }
+        ++decompressed;
+        return 0;
+    }
+
+    // returns information about compressed messages
+    DLLLOCAL QoreHashNode* getInfo() const {
+        int64 in = bytes_in;
+        int64 out = bytes_out;
+        QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+        h->setKeyValue("min_size", (int64)min_size, nullptr);
+        h->setKeyValue("bulk_size", (int64)bulk_size, nullptr);
+        h->setKeyValue("compressed", (int64)compressed, nullptr);
+        h->setKeyValue("skipped", (int64)skipped, nullptr);
+        h->setKeyValue("bytes_in", in, nullptr);
+        h->setKeyValue("bytes_out", out, nullptr);
+        h->setKeyValue("bytes_saved", in - out, nullptr);
+        h->setKeyValue("compress_us", (int64)compress_us, nullptr);
+        h->setKeyValue("decompressed", (int64)decompressed, nullptr);
+        h->setKeyValue("decompress_us", (int64)decompress_us, nullptr);
+        return h;
+    }
+
+private:
+    size_t min_size;
+    size_t bulk_size;
+
+    // number of messages compressed
+    std::atomic<int64> compressed{0};
+    // number of messages not compressed because compression did not reduce the size enough
+    std::atomic<int64> skipped{0};
+    // size of compressed messages before and after compression
+    std::atomic<int64> bytes_in{0};
+    std::atomic<int64> bytes_out{0};
+    // time spent compressing messages, including skipped messages
+    std::atomic<int64> compress_us{0};
+    // number of messages decompressed
+    std::atomic<int64> decompressed{0};
+    // time spent decompressing messages
+    std::atomic<int64> decompress_us{0};
+
+    DLLLOCAL static size_t getSize(const char* var, size_t def) {
+        const char* str = getenv(var);
+        if (!str || !*str) {
+            return def;
+        }
+        char* end;
+        errno = 0;
+        unsigned long long size = strtoull(str, &end, 10);
+        if (!isdigit(*str) || *end || errno) {
+            fprintf(stderr, "WARNING: invalid value for %s: \"%s\"; expecting a non-negative integer; using the "
+                "default value %zu\n", var, str, def);
+            return def;
+        }
+        return (size_t)size;
+    }
+
+    DLLLOCAL static int64 now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    DLLLOCAL static int corrupt(ExceptionSink* xsink) {
+        xsink->raiseException(QORUS_CLUSTER_CODEC_ERR, "the compressed message is truncated or corrupt");
+        return -1;
+    }
+};
+
+DLLLOCAL extern QorusClusterCompression qorus_cluster_compression;
+
+#endif
@@ -0,0 +1,142 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QorusCpcStats.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Cluster API command statistics:
+    * statistics are kept per side of the request (client or server), peer process, and command
+    * client side: the time from sending a request to receiving the first byte of the response, and the response size
+    * server side: the time from receiving a request to dispatching it to its handler, the handler time from
+      dispatching the request to queuing its response, the time the response waits in the I/O queue before it is
+      sent, and the response size
+    * statistics are kept for the lifetime of the process or until they are reset; at most
+      QORUS_CPC_STATS_MAX_KEYS combinations of side, peer, and command are tracked
+*/
+
+#ifndef _QORUS_CPC_STATS_H
+#define _QORUS_CPC_STATS_H
+
+#include <qore/Qore.h>
+
+#include "LatencyHistogram.h"
+
+#include <map>
+#include <string>
+
+// maximum number of side, peer, and command combinations tracked
+#define QORUS_CPC_STATS_MAX_KEYS 10000
+
+class QorusCpcStats {
+public:
+    // adds a sample for a request sent by this process
+    DLLLOCAL void addClient(const char* peer, const char* cmd, int64 send_us, int64 bytes) {
+        AutoLocker al(m);
+        Entry* e = getEntry(true, peer, cmd);
+        if (e) {
+            e->first.add(send_us);
+            e->bytes.add(bytes);
+        }
+    }
+
+    // adds a sample for a request handled by this process
+    DLLLOCAL void addServer(const char* peer, const char* cmd, int64 queue_us, int64 handler_us,
+            int64 response_queue_us, int64 bytes) {
+        AutoLocker al(m);
+        Entry* e = getEntry(false, peer, cmd);
+        if (e) {
+            e->first.add(handler_us);
+            e->second.add(queue_us);
+            e->third.add(response_queue_us);
+            e->bytes.add(bytes);
+        }
+    }
+
+    // returns the statistics as a list of hashes; if \a reset is true, the statistics are cleared
+    DLLLOCAL QoreListNode* get(bool reset) {
+        ReferenceHolder<QoreListNode> l(new QoreListNode(autoHashTypeInfo), nullptr);
+        AutoLocker al(m);
+        for (auto& i : stats) {
+            const Entry& e = i.second;
+            QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+            h->setKeyValue("side", new QoreStringNode(e.client ? "client" : "server"), nullptr);
+            h->setKeyValue("peer", new QoreStringNode(e.peer.c_str()), nullptr);
+            h->setKeyValue("cmd", new QoreStringNode(e.cmd.c_str()), nullptr);
+            h->setKeyValue("count", (int64)e.bytes.getCount(), nullptr);
+            if (e.client) {
+                h->setKeyValue("send_us", getSummary(e.first), nullptr);
+            } else {
+                h->setKeyValue("queue_us", getSummary(e.second), nullptr);
+                h->setKeyValue("handler_us", getSummary(e.first), nullptr);
+                h->setKeyValue("response_queue_us", getSummary(e.third), nullptr);
+            }
+            h->setKeyValue("response_bytes", getSummary(e.bytes), nullptr);
+            l->push(h, nullptr);
+        }
+        if (reset) {
+            stats.clear();
+        }
+        return l.release();
+    }
+
+private:
+    struct Entry {
+        bool client;
+        std::string peer;
+        std::string cmd;
+        // client: send to first byte; server: handler time
+        LatencyHistogram first;
+        // server: wait for dispatch to the handler
+        LatencyHistogram second;
+        // server: response queue wait
+        LatencyHistogram third;
+        // response size
+        LatencyHistogram bytes;
+    };
+
+    QoreThreadLock m;
+    // side, peer, and command -> statistics
+    std::map<std::string, Entry> stats;
+
+    // returns the entry for the given key or nullptr if too many keys are tracked; the lock must be held
+    DLLLOCAL Entry* getEntry(bool client, const char* peer, const char* cmd) {
+        std::string key = std::string(client ? "c" : "s") + peer + '\t' + cmd;
+        auto i = stats.lower_bound(key);
+        if (i != stats.end() && i->first == key) {
+            return &i->second;
+        }
+        if (stats.size() >= QORUS_CPC_STATS_MAX_KEYS) {
+            return nullptr;
+        }
+        i = stats.insert(i, std::make_pair(key, Entry()));
+        i->second.client = client;
+        i->second.peer = peer;
+        i->second.cmd = cmd;
+        return &i->second;
+    }
+
+    DLLLOCAL static QoreHashNode* getSummary(const LatencyHistogram& h) {
+        QoreHashNode* rv = new QoreHashNode(autoTypeInfo);
+        rv->setKeyValue("sum", h.getSum(), nullptr);
+        rv->setKeyValue("avg", h.getAverage(), nullptr);
+        rv->setKeyValue("p50", h.getPercentile(0.5), nullptr);
+        rv->setKeyValue("p90", h.getPercentile(0.9), nullptr);
+        rv->setKeyValue("p99", h.getPercentile(0.99), nullptr);
+        rv->setKeyValue("max", h.getMax(), nullptr);
+        return rv;
+    }
+};
+
+DLLLOCAL extern QorusCpcStats qorus_cpc_stats;
+
+#endif
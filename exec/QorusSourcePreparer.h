@@ -0,0 +1,203 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QorusSourcePreparer.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Background preparation of the embedded Qore sources of a Qorus binary:
+    * embedded sources must be parsed in order into a single Program, and modules must be loaded before the sources
+      that use them, so module loading and parsing stay on the main thread; inflating and preprocessing each source
+      only depends on the source itself, so it is done in worker threads while the main thread loads modules and
+      parses earlier sources
+    * embedded sources are registered during static initialization by code generated by make-source.q
+    * workers prepare sources in registration order; when the main thread needs a source that no worker has started,
+      it prepares the source itself, and when a worker is preparing the source, it waits for it
+    * a source that fails to be prepared in a worker is prepared again on the main thread so that errors are raised
+      there
+    * workers use the Qore API, so they are Qore threads started with q_start_thread()
+*/
+
+#ifndef _QORUS_SOURCE_PREPARER_H
+#define _QORUS_SOURCE_PREPARER_H
+
+#include <qore/Qore.h>
+
+#include "QorusStartupTrace.h"
+
+#include <unistd.h>
+#include <zlib.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+// maximum number of source preparation threads
+#define QORUS_SOURCE_PREPARE_MAX_THREADS 4
+
+class QorusSourcePreparer {
+public:
+    // registers an embedded source; called during static initialization
+    DLLLOCAL void reg(const char* label, const unsigned char* buf, size_t buf_size, size_t src_size) {
+        index[buf] = sources.size();
+        sources.push_back(Source(label, buf, buf_size, src_size));
+    }
+
+    // starts preparing the registered sources in worker threads; must be called after qore_init()
+    DLLLOCAL void start(bool debug_internals) {
+        AutoLocker al(m);
+        assert(!running);
+        this->debug_internals = debug_internals;
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        // leave one CPU for the main thread
+        unsigned nthreads = ncpus > 1 ? ncpus - 1 : 0;
+        if (nthreads > QORUS_SOURCE_PREPARE_MAX_THREADS) {
+            nthreads = QORUS_SOURCE_PREPARE_MAX_THREADS;
+        }
+        if (nthreads > sources.size()) {
+            nthreads = sources.size();
+        }
+        ExceptionSink xsink;
+        for (unsigned i = 0; i < nthreads; ++i) {
+            if (q_start_thread(&xsink, qorus_source_preparer_run, this) < 0) {
+                // sources not prepared by a worker are prepared on the main thread
+                xsink.clear();
+                break;
+            }
+            ++running;
+        }
+    }
+
+    // returns the prepared source for the given buffer, or nullptr if the caller must prepare the source itself
+    /** waits for the source if a worker is preparing it; each source can only be taken once
+    */
+    DLLLOCAL QoreString* take(const unsigned char* buf) {
+        AutoLocker al(m);
+        std::map<const unsigned char*, size_t>::iterator i = index.find(buf);
+        if (i == index.end()) {
+            return nullptr;
+        }
+        Source& s = sources[i->second];
+        if (s.state == SS_PREPARING) {
+            int64 start = QorusStartupTrace::now();
+            while (s.state == SS_PREPARING) {
+                cond.wait(m);
+            }
+            qorus_startup_trace.add("source-wait", s.label, start);
+        }
+        SourceState state = s.state;
+        s.state = SS_TAKEN;
+        return state == SS_DONE ? s.str.release() : nullptr;
+    }
+
+    // stops the workers and waits for them to exit; sources not taken are released
+    DLLLOCAL void stop() {
+        AutoLocker al(m);
+        stopping = true;
+        while (running) {
+            cond.wait(m);
+        }
+        for (auto& i : sources) {
+            i.str.reset();
+        }
+    }
+
+    // inflates and preprocesses an embedded source; returns -1 if an exception was raised
+    DLLLOCAL static int prepare(QoreString& str, const unsigned char* buf, size_t buf_size, size_t src_size,
+            bool debug_internals, ExceptionSink* xsink) {
+        unsigned long size = src_size + 1;
+        str.reserve(size);
+        uncompress((Bytef*)str.c_str(), &size, (Bytef*)buf, buf_size);
+        str.terminate(src_size);
+
+        // remove QDBG_ lines for non-debugging runs of Qorus
+        if (!debug_internals) {
+            QoreString match("^([^\\n]*?QDBG_[A-Z_]+\\(.*?\\).*?;)$");
+            QoreString subst("/*$1*/");
+            str.regexSubstInPlace(match, subst, QS_RE_GLOBAL | QS_RE_DOTALL | QS_RE_MULTILINE, xsink);
+        }
+        return *xsink ? -1 : 0;
+    }
+
+    // worker thread main loop
+    DLLLOCAL void run() {
+        AutoLocker al(m);
+        int thread = ++thread_ids;
+        while (!stopping && next < sources.size()) {
+            Source& s = sources[next++];
+            if (s.state != SS_NONE) {
+                continue;
+            }
+            s.state = SS_PREPARING;
+            std::unique_ptr<QoreString> str(new QoreString);
+            int rc;
+            {
+                AutoUnlocker au(m);
+                int64 start = QorusStartupTrace::now();
+                ExceptionSink xsink;
+                rc = prepare(*str, s.buf, s.buf_size, s.src_size, debug_internals, &xsink);
+                xsink.clear();
+                qorus_startup_trace.add("source-prepare", s.label, start, thread);
+            }
+            if (rc) {
+                s.state = SS_FAILED;
+            } else {
+                s.str = std::move(str);
+                s.state = SS_DONE;
+            }
+            cond.broadcast();
+        }
+        --running;
+        cond.broadcast();
+    }
+
+private:
+    enum SourceState {
+        SS_NONE,
+        SS_PREPARING,
+        SS_DONE,
+        SS_FAILED,
+        SS_TAKEN,
+    };
+
+    struct Source {
+        const char* label;
+        const unsigned char* buf;
+        size_t buf_size;
+        size_t src_size;
+        SourceState state = SS_NONE;
+        std::unique_ptr<QoreString> str;
+
+        DLLLOCAL Source(const char* label, const unsigned char* buf, size_t buf_size, size_t src_size)
+                : label(label), buf(buf), buf_size(buf_size), src_size(src_size) {
+        }
+    };
+
+    QoreThreadLock m;
+    QoreCondition cond;
+    std::vector<Source> sources;
+    // buffer -> source index
+    std::map<const unsigned char*, size_t> index;
+    // index of the next source for a worker
+    size_t next = 0;
+    unsigned running = 0;
+    // number of workers started; used to number worker threads in the startup trace
+    unsigned thread_ids = 0;
+    bool stopping = false;
+    bool debug_internals = false;
+
+    DLLLOCAL static void qorus_source_preparer_run(ExceptionSink* xsink, void* arg) {
+        ((QorusSourcePreparer*)arg)->run();
+    }
+};
+
+#endif
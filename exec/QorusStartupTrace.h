@@ -0,0 +1,131 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QorusStartupTrace.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Startup trace of a Qorus process:
+    * each step has a type (ex: "module", "source-prepare", "source-parse"), a name, the time it started, and its
+      duration
+    * steps may be added from any thread; steps run in background threads have a thread number > 0
+    * startup phases are steps with type "phase"; each phase ends when the next one starts
+    * steps are also added from Qore code for initialization that runs after the program is parsed; the trace is kept
+      for the lifetime of the process, so steps after the first QORUS_STARTUP_TRACE_MAX_STEPS are ignored
+*/
+
+#ifndef _QORUS_STARTUP_TRACE_H
+#define _QORUS_STARTUP_TRACE_H
+
+#include <qore/Qore.h>
+
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// maximum number of steps kept in the startup trace
+#define QORUS_STARTUP_TRACE_MAX_STEPS 10000
+
+class QorusStartupTrace {
+public:
+    DLLLOCAL QorusStartupTrace() : origin(now()) {
+    }
+
+    // returns the current time as microseconds since the epoch
+    DLLLOCAL static int64 now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (int64)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
+
+    // adds a step that started at \a start and ended now
+    DLLLOCAL void add(const char* type, const char* name, int64 start, int thread = 0) {
+        int64 end = now();
+        AutoLocker al(m);
+        addIntern(type, name, start, end, thread);
+    }
+
+    // ends the current phase, if any, and starts the given phase; if \a name is nullptr, only the current phase is
+    // ended
+    DLLLOCAL void phase(const char* name) {
+        int64 t = now();
+        AutoLocker al(m);
+        if (!phase_name.empty()) {
+            addIntern("phase", phase_name.c_str(), phase_start, t, 0);
+        }
+        phase_name = name ? name : "";
+        phase_start = t;
+    }
+
+    // returns the trace as a list of hashes in the order the steps finished
+    DLLLOCAL QoreListNode* get() const {
+        ReferenceHolder<QoreListNode> l(new QoreListNode(autoTypeInfo), nullptr);
+        AutoLocker al(m);
+        for (auto& i : steps) {
+            QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+            h->setKeyValue("type", new QoreStringNode(i.type.c_str()), nullptr);
+            h->setKeyValue("name", new QoreStringNode(i.name.c_str()), nullptr);
+            h->setKeyValue("start", DateTimeNode::makeAbsolute(currentTZ(), i.start / 1000000,
+                (int)(i.start % 1000000)), nullptr);
+            h->setKeyValue("offset_us", i.start - origin, nullptr);
+            h->setKeyValue("us", i.us, nullptr);
+            h->setKeyValue("thread", (int64)i.thread, nullptr);
+            l->push(h, nullptr);
+        }
+        return l.release();
+    }
+
+private:
+    struct Step {
+        std::string type;
+        std::string name;
+        int64 start;
+        int64 us;
+        int thread;
+    };
+
+    mutable QoreThreadLock m;
+    // time the process started tracing as microseconds since the epoch
+    int64 origin;
+    std::vector<Step> steps;
+    // the current phase, if any
+    std::string phase_name;
+    int64 phase_start = 0;
+
+    DLLLOCAL void addIntern(const char* type, const char* name, int64 start, int64 end, int thread) {
+        if (steps.size() < QORUS_STARTUP_TRACE_MAX_STEPS) {
+            steps.push_back({type, name, start, end - start, thread});
+        }
+    }
+};
+
+DLLLOCAL extern QorusStartupTrace qorus_startup_trace;
+
+// adds a step to the startup trace when it goes out of scope
+class QorusStartupStep {
+public:
+    DLLLOCAL QorusStartupStep(const char* type, const char* name) : type(type), name(name),
+            start(QorusStartupTrace::now()) {
+    }
+
+    DLLLOCAL ~QorusStartupStep() {
+        qorus_startup_trace.add(type, name, start);
+    }
+
+private:
+    const char* type;
+    const char* name;
+    int64 start;
+};
+
+#endif
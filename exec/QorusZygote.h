@@ -0,0 +1,382 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    QorusZygote.h
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    Zygote processes for interface binaries:
+    * when an interface binary is started with $QORUS_ZYGOTE_SOCKET set, it loads modules and parses its sources as
+      usual, but instead of running its main class, it listens on the Unix socket at the given path and forks a new
+      process for each request; the forked process runs the main class with the arguments and environment from the
+      request, so modules are loaded and sources are parsed only once per binary
+    * a request consists of the number of arguments followed by the size and data of each argument, then the number
+      of environment variables followed by the size and data of each "name=value" string; all integers are 4 bytes
+      long in network byte order; the response is the PID of the new process or a negative errno value
+    * processes are forked with the Qore fork() function, which fails if any other Qore threads are running
+    * sources are parsed by the zygote with the parse options it was started with; if the arguments and $OMQ_DIR in
+      a request would give different parse options (ex: a different option file or debugging options), -ENOEXEC is
+      returned, and the process must be started normally
+    * forked processes are children of the zygote, not of the process that sent the request, which must manage them
+      by PID
+    * forked processes start a new session with standard input redirected to /dev/null; standard output and error
+      are redirected to the file given by $QORUS_ZYGOTE_OUTPUT in the request or to /dev/null if not set; they are
+      reaped automatically
+    * if a process cannot be forked, -EAGAIN is returned, the error is logged to the zygote's standard error, and the
+      zygote continues to serve requests
+    * the zygote exits when its parent process terminates
+*/
+
+#ifndef _QORUS_ZYGOTE_H
+#define _QORUS_ZYGOTE_H
+
+#include <qore/Qore.h>
+
+#ifndef _Q_WINDOWS
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// environment variable giving the socket path when started as a zygote
+#define QORUS_ZYGOTE_SOCKET_ENV "QORUS_ZYGOTE_SOCKET"
+// environment variable in a request giving the file for the standard output and error of the forked process
+#define QORUS_ZYGOTE_OUTPUT_ENV "QORUS_ZYGOTE_OUTPUT"
+// maximum number of arguments or environment variables in a request
+#define QORUS_ZYGOTE_MAX_STRINGS 4096
+// maximum size of a single argument or environment variable in a request
+#define QORUS_ZYGOTE_MAX_STRING_SIZE (1024 * 1024)
+// timeout for reading a request in seconds
+#define QORUS_ZYGOTE_TIMEOUT 5
+// interval for checking if the parent process is still running in milliseconds
+#define QORUS_ZYGOTE_POLL_INTERVAL 1000
+
+class QorusZygote {
+public:
+    // serves fork requests if the process was started as a zygote
+    /** returns true if the main class must not be run; \a rc is then set to the exit code of the process; returns
+        false if the process was not started as a zygote or if it was forked by the zygote
+
+        \a same_parse is called with the arguments and the value of $OMQ_DIR, if any, of each request and must return
+        true if a process started with them would parse its sources with the same options as the zygote; see
+        qorus_get_parse_check()
+
+        must be called after all sources have been parsed and before any Qore code has been run
+    */
+    DLLLOCAL bool serve(QoreProgram* qpgm, const char* binary,
+            const std::function<bool (const std::vector<std::string>&, const char*)>& same_parse, int& rc,
+            ExceptionSink* xsink) {
+        const char* path = getenv(QORUS_ZYGOTE_SOCKET_ENV);
+        if (!path || !*path) {
+            return false;
+        }
+        rc = 1;
+#ifdef _Q_WINDOWS
+        fprintf(stderr, "ERROR: %s zygote processes are not supported on this platform\n", binary);
+        return true;
+#else
+        std::string spath = path;
+        // forked processes get their environment from the request
+        unsetenv(QORUS_ZYGOTE_SOCKET_ENV);
+
+        int lfd = bindSocket(binary, spath);
+        if (lfd < 0) {
+            return true;
+        }
+
+        // forked processes are reaped automatically
+        signal(SIGCHLD, SIG_IGN);
+
+        pid_t ppid = getppid();
+        while (true) {
+            struct pollfd pfd = {lfd, POLLIN, 0};
+            int prc = poll(&pfd, 1, QORUS_ZYGOTE_POLL_INTERVAL);
+            if (prc < 0 && errno != EINTR) {
+                fprintf(stderr, "ERROR: %s zygote: poll(): %s\n", binary, strerror(errno));
+                break;
+            }
+            if (getppid() != ppid) {
+                rc = 0;
+                break;
+            }
+            if (prc <= 0) {
+                continue;
+            }
+
+            int fd = accept(lfd, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+
+            if (readRequest(fd)) {
+                sendInt(fd, -EINVAL);
+                close(fd);
+                continue;
+            }
+
+            // the sources of the new process would be parsed differently; it must be started normally
+            if (!same_parse(args, getRequestEnv("OMQ_DIR"))) {
+                sendInt(fd, -ENOEXEC);
+                close(fd);
+                args.clear();
+                env.clear();
+                continue;
+            }
+
+            ValueHolder rv(qpgm->callFunction("fork", nullptr, xsink), xsink);
+            if (*xsink) {
+                sendInt(fd, -EAGAIN);
+                close(fd);
+                args.clear();
+                env.clear();
+                // log and clear the exception; the next request may succeed
+                fprintf(stderr, "ERROR: %s zygote: cannot fork a new process:\n", binary);
+                xsink->handleExceptions();
+                continue;
+            }
+            int64 pid = rv->getAsBigInt();
+            if (!pid) {
+                // in the forked process
+                close(fd);
+                close(lfd);
+                initChild();
+                return false;
+            }
+            sendInt(fd, (int)pid);
+            close(fd);
+            args.clear();
+            env.clear();
+        }
+
+        close(lfd);
+        unlink(spath.c_str());
+        return true;
+#endif
+    }
+
+    // returns the arguments and environment if the process was forked by a zygote, otherwise nullptr
+    DLLLOCAL QoreHashNode* getRequest() const {
+        if (!forked) {
+            return nullptr;
+        }
+        ReferenceHolder<QoreListNode> l(new QoreListNode(stringTypeInfo), nullptr);
+        for (const std::string& i : args) {
+            l->push(new QoreStringNode(i.c_str(), i.size(), QCS_UTF8), nullptr);
+        }
+        ReferenceHolder<QoreHashNode> e(new QoreHashNode(stringTypeInfo), nullptr);
+        for (const std::string& i : env) {
+            size_t eq = i.find('=');
+            if (eq == std::string::npos || !eq) {
+                continue;
+            }
+            e->setKeyValue(i.substr(0, eq).c_str(), new QoreStringNode(i.c_str() + eq + 1, i.size() - eq - 1,
+                QCS_UTF8), nullptr);
+        }
+        QoreHashNode* h = new QoreHashNode(autoTypeInfo);
+        h->setKeyValue("args", l.release(), nullptr);
+        h->setKeyValue("env", e.release(), nullptr);
+        return h;
+    }
+
+private:
+    // true in a process forked by the zygote
+    bool forked = false;
+    // arguments from the request
+    std::vector<std::string> args;
+    // environment from the request
+    std::vector<std::string> env;
+
+#ifndef _Q_WINDOWS
+    // returns the listening socket or -1 on error
+    DLLLOCAL static int bindSocket(const char* binary, const std::string& path) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        if (path.size() >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "ERROR: %s zygote: socket path %s is too long\n", binary, path.c_str());
+            return -1;
+        }
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            fprintf(stderr, "ERROR: %s zygote: socket(): %s\n", binary, strerror(errno));
+            return -1;
+        }
+        unlink(path.c_str());
+        // only the current user may connect
+        mode_t old_mask = umask(077);
+        int rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+        umask(old_mask);
+        if (rc || ::listen(fd, SOMAXCONN)) {
+            fprintf(stderr, "ERROR: %s zygote: cannot listen on %s: %s\n", binary, path.c_str(), strerror(errno));
+            close(fd);
+            return -1;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
+    }
+
+    // returns the value of the given environment variable in the request or nullptr if not set
+    DLLLOCAL const char* getRequestEnv(const char* name) const {
+        size_t len = strlen(name);
+        for (const std::string& i : env) {
+            if (i.size() > len && i[len] == '=' && !i.compare(0, len, name)) {
+                return i.c_str() + len + 1;
+            }
+        }
+        return nullptr;
+    }
+
+    // reads a request; returns -1 if the request is invalid
+    DLLLOCAL int readRequest(int fd) {
+        struct timeval tv = {QORUS_ZYGOTE_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        args.clear();
+        env.clear();
+        return readStrings(fd, args) || readStrings(fd, env) ? -1 : 0;
+    }
+
+    DLLLOCAL static int readStrings(int fd, std::vector<std::string>& v) {
+        uint32_t n;
+        if (readInt(fd, n) || n > QORUS_ZYGOTE_MAX_STRINGS) {
+            return -1;
+        }
+        v.reserve(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t size;
+            if (readInt(fd, size) || size > QORUS_ZYGOTE_MAX_STRING_SIZE) {
+                return -1;
+            }
+            v.emplace_back(size, '\0');
+            if (size && readAll(fd, &v.back()[0], size)) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    DLLLOCAL static int readInt(int fd, uint32_t& i) {
+        if (readAll(fd, &i, sizeof(i))) {
+            return -1;
+        }
+        i = ntohl(i);
+        return 0;
+    }
+
+    DLLLOCAL static int readAll(int fd, void* buf, size_t size) {
+        char* p = (char*)buf;
+        while (size) {
+            ssize_t rc = read(fd, p, size);
+            if (rc < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rc <= 0) {
+                return -1;
+            }
+            p += rc;
+            size -= rc;
+        }
+        return 0;
+    }
+
+    DLLLOCAL static void sendInt(int fd, int i) {
+        uint32_t n = htonl((uint32_t)i);
+        const char* p = (const char*)&n;
+        size_t size = sizeof(n);
+        while (size) {
+            ssize_t rc = write(fd, p, size);
+            if (rc < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rc <= 0) {
+                return;
+            }
+            p += rc;
+            size -= rc;
+        }
+    }
+
+    // sets up a forked process
+    DLLLOCAL void initChild() {
+        forked = true;
+        signal(SIGCHLD, SIG_DFL);
+        setsid();
+
+        int fd = open("/dev/null", O_RDWR);
+        if (fd >= 0) {
+            dup2(fd, STDIN_FILENO);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            if (fd > STDERR_FILENO) {
+                close(fd);
+            }
+        }
+
+        // standard output and error go to the output file from the request, if any; the variable is not passed on
+        static const size_t output_len = strlen(QORUS_ZYGOTE_OUTPUT_ENV "=");
+        for (std::vector<std::string>::iterator i = env.begin(), e = env.end(); i != e; ++i) {
+            if (!i->compare(0, output_len, QORUS_ZYGOTE_OUTPUT_ENV "=")) {
+                fd = open(i->c_str() + output_len, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                if (fd >= 0) {
+                    dup2(fd, STDOUT_FILENO);
+                    dup2(fd, STDERR_FILENO);
+                    if (fd > STDERR_FILENO) {
+                        close(fd);
+                    }
+                }
+                env.erase(i);
+                break;
+            }
+        }
+
+        // replace the environment inherited from the zygote
+        std::vector<std::string> names;
+        for (char** e = environ; *e; ++e) {
+            const char* eq = strchr(*e, '=');
+            if (eq) {
+                names.emplace_back(*e, eq - *e);
+            }
+        }
+        for (const std::string& i : names) {
+            unsetenv(i.c_str());
+        }
+        for (const std::string& i : env) {
+            size_t eq = i.find('=');
+            if (eq != std::string::npos && eq) {
+                setenv(i.substr(0, eq).c_str(), i.c_str() + eq + 1, 1);
+            }
+        }
+    }
+#endif
+};
+
+DLLLOCAL extern QorusZygote qorus_zygote;
+
+#endif
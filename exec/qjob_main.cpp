@@ -16,6 +16,11 @@
 
 #include "qorus_lib.h"
 #include "ql_omqlib.h"
+#include "QorusStartupTrace.h"
+#include "QorusZygote.h"
+
+#include "QC_CronSchedule.h"
+#include "QC_JobScheduler.h"
 
 #include <stdio.h>
 #include <libgen.h>
@@ -142,6 +147,9 @@ const char* int_modules[] = {
 
 #define NUM_INT_MODULES (sizeof(int_modules) / sizeof(char*))
 
+// core modules required by the embedded sources; rarely used modules (connection scheme client modules and
+// driver-specific SqlUtil modules; see OMQ::OnDemandModuleList) are loaded by Connections and SqlUtil when first
+// used, and by user code with %requires
 const char* req_modules[] = {
     "zmq",
     "uuid",
@@ -157,28 +165,20 @@ const char* req_modules[] = {
     "YamlRpcClient",
     "DataStreamUtil",
     "DataStreamClient",
-    "TelnetClient",
     "WebSocketClient",
     "Ssh2Connections",
     "XmlRpcConnection",
     "JsonRpcConnection",
     "SoapClient",
     "SmtpClient",
-    "Pop3Client",
     "RestClient",
     "Swagger",
-    "Sap4HanaRestClient",
-    "SewioRestClient",
-    "SewioWebSocketClient",
-    "AwsRestClient",
-    "SalesforceRestClient",
     "BulkSqlUtil",
     "CsvUtil",
     "Logger",
     "FsUtil",
     "DebugUtil",
     "DebugProgramControl",
-    "ZeyosRestClient",
     "Qorize",
     "DbDataProvider",
     "FileLocationHandler",
@@ -187,6 +187,7 @@ const char* req_modules[] = {
 #define NUM_REQ_MODULES (sizeof(req_modules) / sizeof(char*))
 
 static int my_load_mod(const char* name, QoreProgram* qpgm) {
+    QorusStartupStep step("module", name);
     SimpleRefHolder<QoreStringNode> err(MM.parseLoadModule(name, qpgm));
     if (err) {
         fprintf(stderr, "ERROR: cannot load required module '%s': %s\n", name, err->getBuffer());
@@ -213,6 +214,8 @@ int main(int argc, char* argv[]) {
     // add standard module directories afterwards
     MM.addStandardModulePaths();
 
+    qorus_startup_trace.phase("qore-init");
+
     // initialize Qore subsystem
     qore_init(QORUS_LICENSE, "UTF-8", true, QORE_OPTS);
 
@@ -223,11 +226,17 @@ int main(int argc, char* argv[]) {
     int64 po = PO_REQUIRE_OUR | PO_NEW_STYLE | PO_STRICT_ARGS | PO_REQUIRE_TYPES | PO_ALLOW_WEAK_REFERENCES;
 
     // parse command line options that need to take effect before parsing Qorus
+    const int64 base_po = po;
     qorus_dbg_t qorus_dbg = qorus_parse_options(argc, argv, po, opt_map_t());
 
     // setup the command line
     qore_setup_argv(1, argc, argv);
 
+    // prepare embedded sources in the background while modules are loaded
+    qorus_source_prepare_start(qorus_dbg);
+    // stop background source preparation before the Qore library is cleaned up on all exit paths
+    ON_BLOCK_EXIT(qorus_source_prepare_stop);
+
     QoreProgram* qpgm = new QoreProgram(po);
     qpgm->setScriptPath(argv[0]);
 
@@ -240,6 +249,8 @@ int main(int argc, char* argv[]) {
     qpgm->parseDefine("HasJobClass", true);
     qorus_dbg.setDefines(*qpgm);
 
+    qorus_startup_trace.phase("modules");
+
     // load required module(s)
     for (unsigned i = 0; i < NUM_REQ_MODULES; ++i) {
         if (my_load_mod(req_modules[i], qpgm)) {
@@ -261,6 +272,8 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    qorus_startup_trace.phase("setup");
+
     ExceptionSink xsink;
 
    // setup internal modules
@@ -308,8 +321,12 @@ int main(int argc, char* argv[]) {
     init_omqlib_functions(*QNS);
     init_omqlib_constants(*QNS);
 
+    QNS->addSystemClass(initCronScheduleClass(*QNS));
+    QNS->addSystemClass(initJobSchedulerClass(*QNS));
+
     qpgm->getRootNS()->addInitialNamespace(QNS);
 
+    qorus_startup_trace.phase("sources");
     qorus_ThreadLocalData(qorus_dbg.internals, qpgm, &xsink);
     qorus_Map(qorus_dbg.internals, qpgm, &xsink);
     qorus_qjob(qorus_dbg.internals, qpgm, &xsink);
@@ -400,10 +417,15 @@ int main(int argc, char* argv[]) {
     qorus_qorus_job_core_system(qorus_dbg.internals, qpgm, &xsink);
     qorus_qorus_job_system(qorus_dbg.internals, qpgm, &xsink);
 
+    qorus_startup_trace.phase("parse-commit");
     qpgm->parseCommit(&xsink, &xsink, QORUS_WARN_MASK);
+    qorus_source_prepare_stop();
+    qorus_startup_trace.phase(nullptr);
 
     int rc = 0;
-    if (!xsink.isEvent()) {
+    // when started as a zygote, processes forked on request run the main class instead
+    if (!xsink.isEvent() && !qorus_zygote.serve(qpgm, "qjob",
+            qorus_get_parse_check(base_po, po, qorus_dbg, opt_map_t()), rc, &xsink)) {
         qpgm->runClass("QJob", &xsink);
     }
 
@@ -16,6 +16,7 @@
 
 #include "qorus_lib.h"
 #include "ql_omqlib.h"
+#include "QorusStartupTrace.h"
 
 //#include "QC_FastLock.h"
 //#include "QC_AutoFastLock.h"
@@ -23,6 +24,9 @@
 #include "QC_TimedWorkflowCache.h"
 #include "QC_TimedSyncCache.h"
 #include "QC_OrderExpiryCache.h"
+#include "QC_OrderStatsAggregator.h"
+#include "QC_CronSchedule.h"
+#include "QC_JobScheduler.h"
 #include "QC_PerformanceCache.h"
 #include "QC_PerformanceCacheManager.h"
 
@@ -197,6 +201,7 @@ void qorus_ConnectionDependencyManager(bool qorus_dbg_internals, QoreProgram* qp
 void qorus_ActionReason(bool qorus_dbg_internals, QoreProgram* qpgm, ExceptionSink* xsink);
 void qorus_CodeActionReason(bool qorus_dbg_internals, QoreProgram* qpgm, ExceptionSink* xsink);
 void qorus_WorkflowOrderStats(bool qorus_dbg_internals, QoreProgram* qpgm, ExceptionSink* xsink);
+void qorus_QorusPerformanceCaches(bool qorus_dbg_internals, QoreProgram* qpgm, ExceptionSink* xsink);
 void qorus_SchemaSnapshots(bool qorus_dbg_internals, QoreProgram *qpgm, ExceptionSink*xsink);
 void qorus_QorusConfigurationItemProvider(bool qorus_dbg_internals, QoreProgram *qpgm, ExceptionSink* xsink);
 void qorus_FSA(bool qorus_dbg_internals, QoreProgram* qpgm, ExceptionSink* xsink);
@@ -321,6 +326,9 @@ const char* optional_load_first_modules[] = {
 
 #define NUM_OPT_MODULES (sizeof(optional_load_first_modules) / sizeof(char*))
 
+// core modules required by the embedded sources; rarely used modules (connection scheme client modules and
+// driver-specific SqlUtil modules; see OMQ::OnDemandModuleList) are loaded by Connections and SqlUtil when first
+// used, and by user code with %requires
 const char* req_modules[] = {
     "json",
     "process",
@@ -331,7 +339,6 @@ const char* req_modules[] = {
     "xml",
     "yaml",
     "zmq",
-    "AwsRestClient",
     "BulkSqlUtil",
     "ConnectionProvider",
     "CsvUtil",
@@ -352,18 +359,10 @@ const char* req_modules[] = {
     "MailMessage",
     "Mapper",
     "Mime",
-    "MysqlSqlUtil",
     "RestHandler",
-    "OracleSqlUtil",
-    "PgsqlSqlUtil",
-    "Pop3Client",
     "Qorize",
     "Qyaml",
     "RestClient",
-    "SalesforceRestClient",
-    "Sap4HanaRestClient",
-    "SewioRestClient",
-    "SewioWebSocketClient",
     "SmtpClient",
     "SoapClient",
     "SoapHandler",
@@ -371,7 +370,6 @@ const char* req_modules[] = {
     "Ssh2Connections",
     "Swagger",
     "TableMapper",
-    "TelnetClient",
     "Util",
     "WebDavHandler",
     "WebSocketClient",
@@ -383,12 +381,12 @@ const char* req_modules[] = {
     "XmlRpcHandler",
     "YamlRpcClient",
     "YamlRpcHandler",
-    "ZeyosRestClient",
 };
 
 #define NUM_REQ_MODULES (sizeof(req_modules) / sizeof(char*))
 
 static int my_load_mod(const char* name, QoreProgram* qpgm) {
+    QorusStartupStep step("module", name);
     SimpleRefHolder<QoreStringNode> err(MM.parseLoadModule(name, qpgm));
     if (err) {
         fprintf(stderr, "ERROR: cannot load required module '%s': %s\n", name, err->c_str());
@@ -474,6 +472,8 @@ int main(int argc, char* argv[]) {
         po |= PO_STRICT_ARGS | PO_REQUIRE_TYPES;
     }
 
+    qorus_startup_trace.phase("qore-init");
+
     // initialize Qore subsystem
     qore_init(QORUS_LICENSE, "UTF-8", true, qore_lib_opts);
 
@@ -483,6 +483,11 @@ int main(int argc, char* argv[]) {
     // setup the command line
     qore_setup_argv(1, argc, argv);
 
+    // prepare embedded sources in the background while modules are loaded
+    qorus_source_prepare_start(qorus_dbg);
+    // stop background source preparation before the Qore library is cleaned up on all exit paths
+    ON_BLOCK_EXIT(qorus_source_prepare_stop);
+
     QoreProgram* qpgm = new QoreProgram(po);
 
     // set define for Qorus server
@@ -507,8 +512,11 @@ int main(int argc, char* argv[]) {
     qpgm->parseDefine("MEMORY_POLLING", true);
 #endif
 
+    qorus_startup_trace.phase("modules");
+
     // load optional modules
     for (unsigned i = 0; i < NUM_OPT_MODULES; ++i) {
+        QorusStartupStep step("module", optional_load_first_modules[i]);
         SimpleRefHolder<QoreStringNode> err(MM.parseLoadModule(optional_load_first_modules[i], qpgm));
     }
 
@@ -521,6 +529,7 @@ int main(int argc, char* argv[]) {
 
     // try to load the oracle module for functions required by SQLInterface and ServerSQLInterface
     {
+        QorusStartupStep step("module", "oracle");
         SimpleRefHolder<QoreStringNode> err(MM.parseLoadModule("oracle", qpgm));
         if (err)
             qpgm->parseDefine("NO_ORACLE", true);
@@ -533,6 +542,8 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    qorus_startup_trace.phase("setup");
+
     ExceptionSink xsink;
 
    // setup internal modules
@@ -592,9 +603,13 @@ int main(int argc, char* argv[]) {
     QNS->addSystemClass(initTimedWorkflowCacheClass(*QNS));
     QNS->addSystemClass(initTimedSyncCacheClass(*QNS));
     QNS->addSystemClass(initOrderExpiryCacheClass(*QNS));
+    QNS->addSystemClass(initOrderStatsAggregatorClass(*QNS));
+    QNS->addSystemClass(initCronScheduleClass(*QNS));
+    QNS->addSystemClass(initJobSchedulerClass(*QNS));
 
     qpgm->getRootNS()->addInitialNamespace(QNS);
 
+    qorus_startup_trace.phase("sources");
     qorus_LoggerController(qorus_dbg.internals, qpgm, &xsink);
     qorus_qorus_core(qorus_dbg.internals, qpgm, &xsink);
     qorus_qorus_system(qorus_dbg.internals, qpgm, &xsink);
@@ -764,6 +779,7 @@ int main(int argc, char* argv[]) {
     qorus_ActionReason(qorus_dbg.internals, qpgm, &xsink);
     qorus_CodeActionReason(qorus_dbg.internals, qpgm, &xsink);
     qorus_WorkflowOrderStats(qorus_dbg.internals, qpgm, &xsink);
+    qorus_QorusPerformanceCaches(qorus_dbg.internals, qpgm, &xsink);
     qorus_SchemaSnapshots(qorus_dbg.internals, qpgm, &xsink);
     qorus_QorusConfigurationItemProvider(qorus_dbg.internals, qpgm, &xsink);
     qorus_FSA(qorus_dbg.internals, qpgm, &xsink);
@@ -846,7 +862,10 @@ int main(int argc, char* argv[]) {
     qorus_QorusRestartableTransaction(qorus_dbg.internals, qpgm, &xsink);
 
     qorus_QorusParametrizedAuthenticator(qorus_dbg.internals, qpgm, &xsink);
+    qorus_startup_trace.phase("parse-commit");
     qpgm->parseCommit(&xsink, &xsink, QORUS_WARN_MASK);
+    qorus_source_prepare_stop();
+    qorus_startup_trace.phase(nullptr);
 
     int rc = 0;
     if (!xsink.isEvent())
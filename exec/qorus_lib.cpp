@@ -16,8 +16,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <zlib.h>
 
 #include "qorus_lib.h"
+#include "QorusSourcePreparer.h"
+#include "QorusStartupTrace.h"
+#include "QorusClusterCompression.h"
+#include "QorusCpcStats.h"
+#include "QorusZygote.h"
 
 void qorus_setup_module_paths(const char* argv0) {
     SystemEnvironment::set("LANG", "C");
@@ -64,6 +70,49 @@ void qorus_init_pgm(QoreNamespace& ns) {
     ns.addConstant("QorusBuildUser", new QoreStringNode(qorus_build_user));
 }
 
+QorusStartupTrace qorus_startup_trace;
+
+QorusClusterCompression qorus_cluster_compression;
+
+QorusCpcStats qorus_cpc_stats;
+
+QorusZygote qorus_zygote;
+
+// embedded sources are registered during static initialization
+static QorusSourcePreparer& qorus_source_preparer() {
+    static QorusSourcePreparer preparer;
+    return preparer;
+}
+
+qorus_source_reg_t::qorus_source_reg_t(const char* label, const unsigned char* buf, size_t buf_size,
+        size_t src_size) {
+    qorus_source_preparer().reg(label, buf, buf_size, src_size);
+}
+
+void qorus_source_prepare_start(const qorus_dbg_t& qorus_dbg) {
+    qorus_source_preparer().start(qorus_dbg.internals);
+}
+
+void qorus_source_prepare_stop() {
+    qorus_source_preparer().stop();
+}
+
+void qorus_parse_source(bool debug_qorus_internals, QoreProgram* qpgm, const char* label, const unsigned char* buf,
+        size_t buf_size, size_t src_size, ExceptionSink* xsink) {
+    // take the source prepared in the background, otherwise prepare it here
+    std::unique_ptr<QoreString> str(qorus_source_preparer().take(buf));
+    if (!str) {
+        QorusStartupStep step("source-prepare", label);
+        str.reset(new QoreString);
+        if (QorusSourcePreparer::prepare(*str, buf, buf_size, src_size, debug_qorus_internals, xsink)) {
+            return;
+        }
+    }
+
+    QorusStartupStep step("source-parse", label);
+    qpgm->parsePending(str->c_str(), label, xsink, xsink, QORUS_WARN_MASK);
+}
+
 void init_error() {
     fprintf(stderr, "corrupted file, cannot initialize, aborting\n");
     exit(1);
@@ -114,6 +163,16 @@ void qorus_dbg_t::setDefines(QoreProgram& pgm) const {
    command line
  */
 qorus_dbg_t qorus_parse_options(int argc, char* argv[], int64& po, const opt_map_t& opt_map) {
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        args.push_back(argv[i]);
+    }
+    QoreString val;
+    return qorus_parse_options(args, SystemEnvironment::get("OMQ_DIR", val) ? nullptr : val.c_str(), po, opt_map);
+}
+
+qorus_dbg_t qorus_parse_options(const std::vector<std::string>& args, const char* omq_dir, int64& po,
+        const opt_map_t& opt_map) {
     qorus_dbg_t qorus_dbg;
 #ifdef DEBUG
     qorus_dbg.internals = true;
@@ -122,12 +181,12 @@ qorus_dbg_t qorus_parse_options(int argc, char* argv[], int64& po, const opt_map
     std::string option_file;
 
     // first parse the command line
-    for (int i = 1; i < argc; ++i) {
-        char* p = strchr(argv[i], '=');
-        if (!p)
+    for (const std::string& arg : args) {
+        size_t p = arg.find('=');
+        if (p == std::string::npos)
             continue;
-        if (!strncmp(argv[i], "option-file", 11)) {
-            option_file = ++p;
+        if (!arg.compare(0, 11, "option-file")) {
+            option_file = arg.substr(p + 1);
             continue;
         }
         // ignore all other options
@@ -135,20 +194,17 @@ qorus_dbg_t qorus_parse_options(int argc, char* argv[], int64& po, const opt_map
 
     // now parse the options file if necessary
     // get standard option file location if necessary
-    if (option_file.empty()) {
-        QoreString val;
-        if (!SystemEnvironment::get("OMQ_DIR", val)) {
-            if (val == "LSB")
-                option_file = "/etc/qorus/options";
-            else {
-                option_file = val.c_str();
-                option_file += QORE_DIR_SEP;
-                option_file += "etc";
-                option_file += QORE_DIR_SEP;
-                option_file += "options";
-            }
-            //printd(5, "got option file: '%s'\n", option_file.c_str());
+    if (option_file.empty() && omq_dir) {
+        if (!strcmp(omq_dir, "LSB"))
+            option_file = "/etc/qorus/options";
+        else {
+            option_file = omq_dir;
+            option_file += QORE_DIR_SEP;
+            option_file += "etc";
+            option_file += QORE_DIR_SEP;
+            option_file += "options";
         }
+        //printd(5, "got option file: '%s'\n", option_file.c_str());
     }
 
     // parse option file if present
@@ -204,3 +260,11 @@ qorus_dbg_t qorus_parse_options(int argc, char* argv[], int64& po, const opt_map
     return qorus_dbg;
 }
 
+std::function<bool (const std::vector<std::string>&, const char*)> qorus_get_parse_check(int64 base_po, int64 po,
+        const qorus_dbg_t& qorus_dbg, const opt_map_t& opt_map) {
+    return [base_po, po, qorus_dbg, opt_map] (const std::vector<std::string>& args, const char* omq_dir) -> bool {
+        int64 new_po = base_po;
+        return qorus_parse_options(args, omq_dir, new_po, opt_map) == qorus_dbg && new_po == po;
+    };
+}
+
@@ -18,6 +18,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <functional>
 
 class QoreProgram;
@@ -28,6 +29,10 @@ struct qorus_dbg_t {
     bool config_items = false;
 
     DLLLOCAL void setDefines(QoreProgram& pgm) const;
+
+    DLLLOCAL bool operator==(const qorus_dbg_t& other) const {
+        return internals == other.internals && messages == other.messages && config_items == other.config_items;
+    }
 };
 
 typedef std::function<void (const std::string&, int64& po)> q_dbg_opt_func_t;
@@ -46,5 +51,25 @@ DLLLOCAL void qorus_setup_module_paths(const char* argv0);
 DLLLOCAL void qorus_init_pgm(QoreNamespace& ns);
 DLLLOCAL void init_error();
 DLLLOCAL qorus_dbg_t qorus_parse_options(int argc, char* argv[], int64& po, const opt_map_t& opt_map);
+// parses options for the given arguments (without the program name) and value of $OMQ_DIR, which may be nullptr
+DLLLOCAL qorus_dbg_t qorus_parse_options(const std::vector<std::string>& args, const char* omq_dir, int64& po,
+        const opt_map_t& opt_map);
+// returns a function that checks if a process started with the given arguments and value of $OMQ_DIR would parse
+// its sources with the same options as the current process, which parsed its options with qorus_parse_options()
+// starting with \a base_po; used by zygote processes
+DLLLOCAL std::function<bool (const std::vector<std::string>&, const char*)> qorus_get_parse_check(int64 base_po,
+        int64 po, const qorus_dbg_t& qorus_dbg, const opt_map_t& opt_map);
+
+// starts preparing embedded sources in background threads; call after qore_init() and before loading modules
+DLLLOCAL void qorus_source_prepare_start(const qorus_dbg_t& qorus_dbg);
+// stops background source preparation and releases sources not parsed; call after all embedded sources are parsed
+DLLLOCAL void qorus_source_prepare_stop();
+// registers an embedded source for background preparation; used by code generated by make-source.q
+struct qorus_source_reg_t {
+    DLLLOCAL qorus_source_reg_t(const char* label, const unsigned char* buf, size_t buf_size, size_t src_size);
+};
+// parses an embedded source; called by code generated by make-source.q
+DLLLOCAL void qorus_parse_source(bool debug_qorus_internals, QoreProgram* qpgm, const char* label,
+        const unsigned char* buf, size_t buf_size, size_t src_size, ExceptionSink* xsink);
 
 #endif
@@ -16,6 +16,7 @@
 
 #include "qorus_lib.h"
 #include "ql_omqlib.h"
+#include "QorusStartupTrace.h"
 
 #include <stdio.h>
 #include <libgen.h>
@@ -111,6 +112,7 @@ const char* req_modules[] = {
 #define NUM_REQ_MODULES (sizeof(req_modules) / sizeof(char*))
 
 static int my_load_mod(const char* name, QoreProgram* qpgm) {
+    QorusStartupStep step("module", name);
     SimpleRefHolder<QoreStringNode> err(MM.parseLoadModule(name, qpgm));
     if (err) {
         fprintf(stderr, "ERROR: cannot load required module '%s': %s\n", name, err->getBuffer());
@@ -137,6 +139,8 @@ int main(int argc, char* argv[]) {
     // add standard module directories afterwards
     MM.addStandardModulePaths();
 
+    qorus_startup_trace.phase("qore-init");
+
     // initialize Qore subsystem
     qore_init(QORUS_LICENSE, "UTF-8", true, QORE_OPTS);
 
@@ -152,6 +156,11 @@ int main(int argc, char* argv[]) {
     // setup the command line
     qore_setup_argv(1, argc, argv);
 
+    // prepare embedded sources in the background while modules are loaded
+    qorus_source_prepare_start(qorus_dbg);
+    // stop background source preparation before the Qore library is cleaned up on all exit paths
+    ON_BLOCK_EXIT(qorus_source_prepare_stop);
+
     QoreProgram* qpgm = new QoreProgram(po);
 
     // set define for Qorus server
@@ -169,12 +178,16 @@ int main(int argc, char* argv[]) {
     qpgm->parseDefine("MEMORY_POLLING", true);
 #endif
 
+    qorus_startup_trace.phase("modules");
+
     // load required module(s)
     for (unsigned i = 0; i < NUM_REQ_MODULES; ++i) {
         if (my_load_mod(req_modules[i], qpgm))
             return 1;
     }
 
+    qorus_startup_trace.phase("setup");
+
     ExceptionSink xsink;
 
    // setup internal modules
@@ -225,6 +238,7 @@ int main(int argc, char* argv[]) {
     init_omqlib_constants(*QNS);
     qpgm->getRootNS()->addInitialNamespace(QNS);
 
+    qorus_startup_trace.phase("sources");
     qorus_q(qorus_dbg.internals, qpgm, &xsink);
     qorus_qorus(qorus_dbg.internals, qpgm, &xsink);
     qorus_qorus_common_master_core_client(qorus_dbg.internals, qpgm, &xsink);
@@ -266,7 +280,10 @@ int main(int argc, char* argv[]) {
     qorus_cpc_svc_api(qorus_dbg.internals, qpgm, &xsink);
     qorus_cpc_wf_api(qorus_dbg.internals, qpgm, &xsink);
 
+    qorus_startup_trace.phase("parse-commit");
     qpgm->parseCommit(&xsink, &xsink, QORUS_WARN_MASK);
+    qorus_source_prepare_stop();
+    qorus_startup_trace.phase(nullptr);
 
     int rc = 0;
     if (!xsink.isEvent())
@@ -0,0 +1,96 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    qorus_test_module.cpp
+*/
+
+/*
+    Qorus Integration Engine(R) Community Edition
+
+    Copyright (C) 2003 - 2023 Qore Technologies, s.r.o., all rights reserved
+
+    LICENSE: GNU GPLv3
+
+    https://www.gnu.org/licenses/gpl-3.0.en.html
+*/
+
+/*
+    QorusNativeTest binary module: provides the native classes and internal functions of the server processes to
+    unit tests, so that they can be tested in the test process itself
+
+    the module is only built for tests and is not installed
+*/
+
+#include <qore/Qore.h>
+
+#include "ql_omqlib.h"
+#include "QorusStartupTrace.h"
+#include "QorusClusterCompression.h"
+#include "QorusCpcStats.h"
+#include "QorusZygote.h"
+
+#include "QC_SegmentEventQueue.h"
+#include "QC_TimedWorkflowCache.h"
+#include "QC_TimedSyncCache.h"
+#include "QC_OrderExpiryCache.h"
+#include "QC_OrderStatsAggregator.h"
+#include "QC_CronSchedule.h"
+#include "QC_JobScheduler.h"
+#include "QC_PerformanceCache.h"
+#include "QC_PerformanceCacheManager.h"
+
+// process-wide state used by the internal functions; defined in qorus_lib.cpp for the server binaries
+QorusStartupTrace qorus_startup_trace;
+
+QorusClusterCompression qorus_cluster_compression;
+
+QorusCpcStats qorus_cpc_stats;
+
+QorusZygote qorus_zygote;
+
+static QoreStringNode* qorus_test_module_init();
+static void qorus_test_module_ns_init(QoreNamespace* rns, QoreNamespace* qns);
+static void qorus_test_module_delete();
+
+DLLEXPORT char qore_module_name[] = "QorusNativeTest";
+DLLEXPORT char qore_module_version[] = "1.0";
+DLLEXPORT char qore_module_description[] = "Qorus native classes and functions for unit tests";
+DLLEXPORT char qore_module_author[] = "Qore Technologies, s.r.o.";
+DLLEXPORT char qore_module_url[] = "https://qoretechnologies.com";
+DLLEXPORT int qore_module_api_major = QORE_MODULE_API_MAJOR;
+DLLEXPORT int qore_module_api_minor = QORE_MODULE_API_MINOR;
+DLLEXPORT qore_module_init_t qore_module_init = qorus_test_module_init;
+DLLEXPORT qore_module_ns_init_t qore_module_ns_init = qorus_test_module_ns_init;
+DLLEXPORT qore_module_delete_t qore_module_delete = qorus_test_module_delete;
+DLLEXPORT qore_license_t qore_module_license = QL_GPL;
+DLLEXPORT char qore_module_license_str[] = "GPL";
+
+// the same namespace as in the server binaries
+static QoreNamespace* QNS;
+
+static QoreStringNode* qorus_test_module_init() {
+    QNS = new QoreNamespace("Qorus");
+
+    init_omqlib_functions(*QNS);
+    init_omqlib_constants(*QNS);
+
+    // the same classes as in qorus-core
+    QNS->addSystemClass(initSegmentEventQueueClass(*QNS));
+    QNS->addSystemClass(initPerformanceCacheClass(*QNS));
+    QNS->addSystemClass(initPerformanceCacheManagerClass(*QNS));
+    QNS->addSystemClass(initTimedWorkflowCacheClass(*QNS));
+    QNS->addSystemClass(initTimedSyncCacheClass(*QNS));
+    QNS->addSystemClass(initOrderExpiryCacheClass(*QNS));
+    QNS->addSystemClass(initOrderStatsAggregatorClass(*QNS));
+    QNS->addSystemClass(initCronScheduleClass(*QNS));
+    QNS->addSystemClass(initJobSchedulerClass(*QNS));
+
+    return nullptr;
+}
+
+static void qorus_test_module_ns_init(QoreNamespace* rns, QoreNamespace* qns) {
+    rns->addInitialNamespace(QNS->copy());
+}
+
+static void qorus_test_module_delete() {
+    delete QNS;
+}
@@ -16,6 +16,8 @@
 
 #include "qorus_lib.h"
 #include "ql_omqlib.h"
+#include "QorusStartupTrace.h"
+#include "QorusZygote.h"
 
 #include <stdio.h>
 #include <libgen.h>
@@ -156,6 +158,9 @@ const char* int_modules[] = {
 
 #define NUM_INT_MODULES (sizeof(int_modules) / sizeof(char*))
 
+// core modules required by the embedded sources; rarely used modules (connection scheme client modules and
+// driver-specific SqlUtil modules; see OMQ::OnDemandModuleList) are loaded by Connections and SqlUtil when first
+// used, and by user code with %requires
 const char* req_modules[] = {
     "zmq",
     "uuid",
@@ -175,7 +180,6 @@ const char* req_modules[] = {
     "DataStreamUtil",
     "DataStreamClient",
     "DataStreamRequestHandler",
-    "TelnetClient",
     "WebSocketClient",
     "WebSocketHandler",
     "Ssh2Connections",
@@ -183,14 +187,8 @@ const char* req_modules[] = {
     "JsonRpcConnection",
     "SoapClient",
     "SmtpClient",
-    "Pop3Client",
     "RestClient",
     "Swagger",
-    "Sap4HanaRestClient",
-    "SewioRestClient",
-    "SewioWebSocketClient",
-    "AwsRestClient",
-    "SalesforceRestClient",
     "BulkSqlUtil",
     "WebUtil",
     "Logger",
@@ -198,7 +196,6 @@ const char* req_modules[] = {
     "FsUtil",
     "DebugUtil",
     "DebugProgramControl",
-    "ZeyosRestClient",
     "Qorize",
     "DbDataProvider",
     "FileLocationHandler",
@@ -207,6 +204,7 @@ const char* req_modules[] = {
 #define NUM_REQ_MODULES (sizeof(req_modules) / sizeof(char*))
 
 static int my_load_mod(const char* name, QoreProgram* qpgm) {
+    QorusStartupStep step("module", name);
     SimpleRefHolder<QoreStringNode> err(MM.parseLoadModule(name, qpgm));
     if (err) {
         fprintf(stderr, "ERROR: cannot load required module '%s': %s\n", name, err->getBuffer());
@@ -238,6 +236,8 @@ int main(int argc, char* argv[]) {
     // add standard module directories afterwards
     MM.addStandardModulePaths();
 
+    qorus_startup_trace.phase("qore-init");
+
     // initialize Qore subsystem
     qore_init(QORUS_LICENSE, "UTF-8", true, QORE_OPTS);
 
@@ -248,11 +248,17 @@ int main(int argc, char* argv[]) {
     int64 po = PO_REQUIRE_OUR | PO_NEW_STYLE | PO_STRICT_ARGS | PO_REQUIRE_TYPES | PO_ALLOW_WEAK_REFERENCES;
 
     // parse command line options that need to take effect before parsing Qorus
+    const int64 base_po = po;
     qorus_dbg_t qorus_dbg = qorus_parse_options(argc, argv, po, opt_map_t());
 
     // setup the command line
     qore_setup_argv(1, argc, argv);
 
+    // prepare embedded sources in the background while modules are loaded
+    qorus_source_prepare_start(qorus_dbg);
+    // stop background source preparation before the Qore library is cleaned up on all exit paths
+    ON_BLOCK_EXIT(qorus_source_prepare_stop);
+
     QoreProgram* qpgm = new QoreProgram(po);
     qpgm->setScriptPath(argv[0]);
 
@@ -274,6 +280,8 @@ int main(int argc, char* argv[]) {
 
     qorus_dbg.setDefines(*qpgm);
 
+    qorus_startup_trace.phase("modules");
+
     // load required module(s)
     for (unsigned i = 0; i < NUM_REQ_MODULES; ++i) {
         if (my_load_mod(req_modules[i], qpgm))
@@ -294,6 +302,8 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    qorus_startup_trace.phase("setup");
+
     ExceptionSink xsink;
 
    // setup internal modules
@@ -343,6 +353,7 @@ int main(int argc, char* argv[]) {
 
     qpgm->getRootNS()->addInitialNamespace(QNS);
 
+    qorus_startup_trace.phase("sources");
     qorus_ThreadLocalData(qorus_dbg.internals, qpgm, &xsink);
     qorus_Map(qorus_dbg.internals, qpgm, &xsink);
     qorus_qsvc(qorus_dbg.internals, qpgm, &xsink);
@@ -447,10 +458,15 @@ int main(int argc, char* argv[]) {
     qorus_QorusIndependentProcess(qorus_dbg.internals, qpgm, &xsink);
     qorus_QorusOptionsBase(qorus_dbg.internals, qpgm, &xsink);
 
+    qorus_startup_trace.phase("parse-commit");
     qpgm->parseCommit(&xsink, &xsink, QORUS_WARN_MASK);
+    qorus_source_prepare_stop();
+    qorus_startup_trace.phase(nullptr);
 
     int rc = 0;
-    if (!xsink.isEvent())
+    // when started as a zygote, processes forked on request run the main class instead
+    if (!xsink.isEvent() && !qorus_zygote.serve(qpgm, "qsvc",
+            qorus_get_parse_check(base_po, po, qorus_dbg, opt_map_t()), rc, &xsink))
         qpgm->runClass("QSvc", &xsink);
 
     qpgm->waitForTerminationAndDeref(&xsink);